@@ -8,13 +8,19 @@
 
         To compile using GCC to 'ssstock' :
 
-            g++ -Wall -o ssstock jp_morgan.cpp -lm
+            g++ -Wall -O2 -pthread -o ssstock jp_morgan.cpp -lm
 
         To compile using Microsoft C to to 'ssstock.exe':
 
             cl /Fessstock /TP /EHsc jp_morgan.cpp
 
-        Tested on Mac OS X, Windows and Linux.
+        Tested on Mac OS X, Windows and Linux. The market data feed
+        handler uses recvmmsg() and is only available on Linux, as is
+        pinning threads to CPUs.
+
+        Any arguments are run as commands before the prompt, eg.
+
+            ssstock "threads ingestion 1" "threads network 2" "feed start 7000"
 
     NOTES:
 
@@ -28,9 +34,49 @@
 #include <math.h>
 #include <time.h>
 #include <sstream>
+#include <fstream>
 #include <iterator>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
-#define FIFTEEN_MINS    15 * 60
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
 
 // Stock types
 
@@ -48,425 +94,9016 @@ enum
     SELL_STOCK,
 };
 
+// Monotonic clock for measuring, in nanoseconds
 
-// A trade operation record (all members public to ease handling)
+static inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-class trade_op
+// Position of the lowest set bit, v must not be 0
+
+static inline int lowest_bit(uint64_t v)
 {
-    public:
-        time_t      stamp;
-        std::string symbol;
-        int         operation;
-        int         quantity;
-        double      price;
+#ifdef _MSC_VER
+    unsigned long i;
 
-        trade_op(std::string &sy,int op,int qty,double pr)
-        {
-            stamp = time(NULL);
-            symbol = sy;
-            operation = (op == BUY_STOCK) ? BUY_STOCK : SELL_STOCK;
-            quantity = qty;
-            price = pr;
-        }
-};
+    _BitScanForward64(&i,v);
+    return (int)i;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
 
-// A rudimentary trading database
+static inline uint64_t byte_swap64(uint64_t v)
+{
+#ifdef _MSC_VER
+    return _byteswap_uint64(v);
+#else
+    return __builtin_bswap64(v);
+#endif
+}
 
-std::vector<trade_op> trade_db;
+/*
+    Startup profile. Globals mark the end of their part of static
+    construction and main() the steps after it, up to the first prompt
+    and the first trade, so "startup" shows where a slow start went. It
+    has no constructor, so it is zeroed before any global is built and
+    marks work from any of them.
+*/
 
-// An entry to the GBCE index
+#define STARTUP_PHASES  16
 
-class stock
+class startup_profile
 {
     private:
 
-        std::string symbol;
-        int         type;
-        double      last_dividend;
-        double      fixed_dividend;
-        double      par_value;
-        double      price;
-
-    public:
-
-        stock(const std::string &sy,int ty,double ld,double fd,double pv)
+        struct phase
         {
-            symbol = sy;
-            type = (ty==PREF_STOCK) ? ty : COMMON_STOCK;
-            last_dividend = ld;
-            fixed_dividend = fd;
+            const char  *name;
+            uint64_t    at;
+        };
 
-            // Initial price same than par value.
+        phase       list[STARTUP_PHASES];
+        size_t      count;
 
-            par_value = price = pv;
-        }
+    public:
 
-        std::string get_symbol() const
+        void mark(const char *name)
         {
-            return symbol;
+            if(count < STARTUP_PHASES)
+            {
+                list[count].name = name;
+                list[count].at = now_ns();
+                count++;
+            }
         }
 
-        double get_price() const
+        // Nanoseconds from the first mark to the named one, 0 if not reached
+
+        uint64_t elapsed(const char *name) const
         {
-            return price;
+            for(size_t i = 1; i < count; i++)
+            {
+                if(!strcmp(list[i].name,name))
+                    return list[i].at - list[0].at;
+            }
+            return 0;
         }
 
-        // Calculate Dividend yield
-
-        double get_dividend_yield() const
+        void show() const
         {
-            switch(type)
+            std::cout << "phase                  at ms    took ms" << std::endl;
+            std::cout << std::setprecision(3) << std::fixed;
+
+            for(size_t i = 1; i < count; i++)
             {
-                case COMMON_STOCK:
-                    return (last_dividend / price);
-                case PREF_STOCK:
-                    return (fixed_dividend / price);
-                default:
-                    break;
+                std::cout << std::left << std::setw(18) << list[i].name << std::right;
+                std::cout << std::setw(10) << (list[i].at - list[0].at) / 1e6;
+                std::cout << std::setw(11) << (list[i].at - list[i - 1].at) / 1e6 << std::endl;
             }
-            return 0.0;
         }
+};
 
-        // Calculate Price/Earnings Ratio
+startup_profile startup;
 
-        double get_pe_ratio() const
-        {
-            if(last_dividend)
-                return (price / last_dividend);
-            return 0.0;
-        }
+struct startup_mark
+{
+    startup_mark(const char *name)
+    {
+        startup.mark(name);
+    }
+};
 
-        // Set the price of the stock based on trading of a time interval
+startup_mark startup_begin("start");
 
-        double set_price(time_t interval)
-        {
-            int trades = 0;
-            double tq=0.0,q=0.0;
+/*
+    Memory for big tables. The trade database, the stock windows and the
+    feed queue can be backed by huge pages to cut TLB misses on random
+    access. Blocks smaller than a huge page come from the heap as usual;
+    larger ones are mapped trying the configured page size first and
+    falling back to smaller pages when the system has none to give.
+*/
 
-            std::vector<trade_op>::const_iterator op = trade_db.begin();
+enum
+{
+    PAGES_NORMAL = 0,   // Heap, normal pages
+    PAGES_THP,          // Transparent huge pages (madvise)
+    PAGES_2MB,          // hugetlbfs 2MB pages
+    PAGES_1GB,          // hugetlbfs 1GB pages
+    PAGES_KINDS
+};
 
-            while (op != trade_db.end())
-            {
-                if(!symbol.compare(op->symbol))
-                {
-                    //  This is not the way to calculate time lapses
-                    //  in the real world but its OK for this test.
+const char *page_names[PAGES_KINDS] = { "off", "thp", "2mb", "1gb" };
 
-                    if( interval >= (time(NULL) - op->stamp) )
-                    {
-                        tq += (op->quantity * op->price);
-                         q += op->quantity;
+#define HUGE_2MB        ((size_t)2 << 20)
+#define HUGE_1GB        ((size_t)1 << 30)
 
-                        trades++;
-                    }
-                }
-                op++;
-            }
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
 
-            // Only modify price if there was trading
+class page_pool
+{
+    private:
 
-            if(trades)
-                price = (tq / q);
+        struct block
+        {
+            size_t      length;     // Mapped length
+            int         kind;       // PAGES_ value
+            bool        locked;     // mlock()ed
+        };
 
-            return price;
-        }
+        std::mutex              lock;
+        int                     mode;
+        bool                    prefault;   // Touch new blocks so they never fault later
+        bool                    pin;        // And lock them in memory
+        std::map<void *,block>  blocks;
+        size_t                  bytes[PAGES_KINDS];
+        size_t                  locked;
+        size_t                  lock_failures;
 
-        // Show an stock
+        // Fault in (and lock if asked) a new block
 
-        void show() const
+        void prepare(void *p,block &b)
         {
-            std::cout << std::setw(3) << symbol << " ";
-            std::cout << std::setw(4) << (type==PREF_STOCK ? "PREF" : "COMM") << " ";
-            std::cout << std::setw(8) << last_dividend << " ";
-            std::cout << std::setw(3) << fixed_dividend << " ";
-            std::cout << std::setw(8) << par_value << " ";
-            std::cout << std::setw(8) << price << std::endl;
-        }
-};
+            b.locked = false;
 
+            if(!prefault)
+                return;
 
-// Sample Table (values in pounds instead pennies to use doubles instead integers).
+            volatile char *c = (volatile char *)p;
 
-class the_index
-{
-    private:
-        std::vector<stock> list;
+            for(size_t i = 0; i < b.length; i += 4096)
+                c[i] = 0;
 
-    public:
+#ifdef __linux__
+            if(pin)
+            {
+                if(!mlock(p,b.length))
+                {
+                    b.locked = true;
+                    locked += b.length;
+                }
+                else
+                {
+                    lock_failures++;
+                }
+            }
+#endif
+        }
 
-        the_index()
+        static size_t round_up(size_t n,size_t page)
         {
-            list.push_back(stock("TEA",COMMON_STOCK,0.00,0, 1.00));
-            list.push_back(stock("POP",COMMON_STOCK,0.08,0, 1.00));
-            list.push_back(stock("ALE",COMMON_STOCK,0.23,0, 0.60));
-            list.push_back(stock("GIN",PREF_STOCK,0.08,2, 1.00));
-            list.push_back(stock("JOE",COMMON_STOCK,0.13,0, 2.50));
+            return (n + page - 1) & ~(page - 1);
         }
 
-        // Check if a symbol exists in the index
-
-        bool exist(const std::string symbol)
+        void *map(size_t n,int kind,size_t &length)
         {
-            std::vector<stock>::const_iterator st = list.begin();
+#ifdef __linux__
+            void *p;
 
-            while (st != list.end())
+            if(kind == PAGES_1GB || kind == PAGES_2MB)
             {
-                if(!symbol.compare(st->get_symbol()))
-                    return true;
-                st++;
+                int shift = (kind == PAGES_1GB) ? 30 : 21;
+
+                length = round_up(n,(size_t)1 << shift);
+                p = mmap(NULL,length,PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT) |
+                         (prefault ? MAP_POPULATE : 0),-1,0);
+
+                return (p == MAP_FAILED) ? NULL : p;
             }
-            return false;
-        }
 
-        // A function to show the index list
+            // THP needs a 2MB aligned block: map one page more and trim
 
-        void show()
-        {
-            std::cout << std::setprecision(2) << std::fixed;
+            length = round_up(n,HUGE_2MB);
+            p = mmap(NULL,length + HUGE_2MB,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+            if(p == MAP_FAILED)
+                return NULL;
 
-            std::cout << "=== ==== ======== ==== ======== ========" << std::endl;
-            std::cout << "Sym Type Last Div Fix  PAR Val. T. Price" << std::endl;
-            std::cout << "=== ==== ======== ==== ======== ========" << std::endl;
+            char *raw = (char *)p;
+            char *aligned = (char *)round_up((size_t)raw,HUGE_2MB);
 
-            std::vector<stock>::const_iterator st = list.begin();
+            if(aligned > raw)
+                munmap(raw,aligned - raw);
+            munmap(aligned + length,(raw + HUGE_2MB) - aligned);
 
-            while (st != list.end())
-            {
-                st->show();
-                st++;
-            }
+            madvise(aligned,length,MADV_HUGEPAGE);
+
+            return aligned;
+#else
+            return NULL;
+#endif
         }
 
-        // A function to trade stock
+    public:
 
-        bool trade(std::string &symbol,int op,int num,double price)
+        page_pool() : mode(PAGES_NORMAL), prefault(false), pin(false), locked(0), lock_failures(0)
         {
-            /* Check if parameters correct */
-
-            if(symbol.empty() || price < 0 || num < 0)
-                return false;
+            for(int k = 0; k < PAGES_KINDS; k++)
+                bytes[k] = 0;
+        }
 
-            trade_db.push_back(trade_op(symbol,op,num,price));
+        // From now on fault in new blocks as they are allocated, and
+        // lock them in memory if 'lock_pages'.
 
-            return true;
+        void set_prefault(bool lock_pages)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            prefault = true;
+            pin = lock_pages;
         }
 
-        // A random trading operation
+        bool lock_failed()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return lock_failures != 0;
+        }
 
-        void random_trade(const char *sym)
+        void set_mode(int m)
         {
-            std::string symbol(sym);
+            std::lock_guard<std::mutex> guard(lock);
+            mode = m;
+        }
 
-            trade_db.push_back(
-                trade_op(
-                    symbol,
-                    (rand() & 1) ? BUY_STOCK : SELL_STOCK,
-                    1 + (rand() % 109),
-                    0.41 + ((double)(rand() % 299) / 100.0)
-                )
-            );
+        int get_mode()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return mode;
         }
 
-        // Calculate the index
+        // Get a block, from the configured kind of pages unless told otherwise
 
-        double get_index(void)
+        void *allocate(size_t n,int kind = -1)
         {
-            double tmp = 1.0,num;
+            std::lock_guard<std::mutex> guard(lock);
 
-            std::vector<stock>::const_iterator st = list.begin();
+            if(kind < 0)
+                kind = mode;
 
-            while (st != list.end())
+            if(kind != PAGES_NORMAL && n >= HUGE_2MB)
             {
-                /* ignore 0 values from input but take them into account
-                   in the n-root calculation. This throws the same result
-                   than changing zeros to ones before each multiplication,
-                   but its a lot faster. ;-)
-                */
-                num = st->get_price();
-                if(num)
-                    tmp*=num;
-                st++;
+                for(int k = kind; k > PAGES_NORMAL; k--)
+                {
+                    block b;
+                    void *p = map(n,k,b.length);
+
+                    if(p)
+                    {
+                        b.kind = k;
+                        prepare(p,b);
+                        blocks[p] = b;
+                        bytes[k] += b.length;
+                        return p;
+                    }
+                }
             }
 
-            num = (double) list.size();
+            void *p = ::operator new(n);
+            block b;
 
-            return pow(tmp, 1.00 / num );
-        }
+            b.kind = PAGES_NORMAL;
+            b.length = n;
+            prepare(p,b);
 
+            // Heap blocks are only tracked if they need unlocking
 
-        void dividend_yield()
-        {
-            std::cout << std::setprecision(2) << std::fixed;
+            if(b.locked)
+                blocks[p] = b;
 
-            std::vector<stock>::const_iterator st = list.begin();
+            bytes[PAGES_NORMAL] += n;
 
-            while (st != list.end())
-            {
-                std::cout << "Dividend Yield of " << st->get_symbol();
-                std::cout << " is " << st->get_dividend_yield() << std::endl;
-                st++;
-            }
+            return p;
         }
 
-        void pe_ratio()
+        // The kind of pages a block actually got
+
+        int kind_of(void *p)
         {
-            std::cout << std::setprecision(2) << std::fixed;
+            std::lock_guard<std::mutex> guard(lock);
+            std::map<void *,block>::iterator b = blocks.find(p);
 
-            std::vector<stock>::const_iterator st = list.begin();
+            return (b == blocks.end()) ? PAGES_NORMAL : b->second.kind;
+        }
 
-            while (st != list.end())
+        void release(void *p,size_t n)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::map<void *,block>::iterator b = blocks.find(p);
+
+            if(b == blocks.end())
             {
-                std::cout << "Price/Earnings Ratio of " << st->get_symbol();
-                std::cout << " is " << st->get_pe_ratio() << std::endl;
-                st++;
+                bytes[PAGES_NORMAL] -= n;
+                ::operator delete(p);
+                return;
             }
+
+            if(b->second.locked)
+                locked -= b->second.length;
+
+#ifdef __linux__
+            if(b->second.kind == PAGES_NORMAL)
+                munlock(p,b->second.length);
+            else
+                munmap(p,b->second.length);
+#endif
+            if(b->second.kind == PAGES_NORMAL)
+                ::operator delete(p);
+
+            bytes[b->second.kind] -= b->second.length;
+            blocks.erase(b);
         }
 
-        void price()
+        void show()
         {
-            std::cout << std::setprecision(2) << std::fixed;
+            std::lock_guard<std::mutex> guard(lock);
 
-            std::vector<stock>::iterator st = list.begin();
+            std::cout << "Huge pages " << page_names[mode] << ", table memory";
+            std::cout << " heap " << (bytes[PAGES_NORMAL] >> 10) << "K";
+            std::cout << " thp " << (bytes[PAGES_THP] >> 10) << "K";
+            std::cout << " 2mb " << (bytes[PAGES_2MB] >> 10) << "K";
+            std::cout << " 1gb " << (bytes[PAGES_1GB] >> 10) << "K" << std::endl;
 
-            while (st != list.end())
+            if(prefault)
             {
-                st->set_price(FIFTEEN_MINS);
-
-                std::cout << "Price of " << st->get_symbol();
-                std::cout << " is " << st->get_price() << std::endl;
-                st++;
+                std::cout << "Prefaulting new blocks";
+                if(pin)
+                    std::cout << ", " << (locked >> 10) << "K locked (" << lock_failures << " lock failures)";
+                std::cout << std::endl;
             }
         }
+};
 
-        // Show all trading operations
+page_pool huge_pages;
 
-        void list_trade()
-        {
-            struct tm *td;
+// An allocator handing out page_pool memory, for containers of big tables
 
-            std::vector<trade_op>::const_iterator op = trade_db.begin();
+template <class T> class huge_allocator
+{
+    public:
 
-            std::cout << std::setprecision(2) << std::fixed;
+        typedef T value_type;
 
-            while (op != trade_db.end())
-            {
-                td = localtime(&(op->stamp));
+        huge_allocator()
+        {
+        }
 
-                std::cout << "[" << std::setw(4) << (td->tm_year % 256) + 1900;
-                std::cout << "-" << std::setw(2) << td->tm_mon+1;
-                std::cout << "-" << std::setw(2) << td->tm_mday;
-                std::cout << " " << std::setw(2) << td->tm_hour;
-                std::cout << ":" << std::setw(2) << td->tm_min;
-                std::cout << ":" << std::setw(2) << td->tm_sec;
-                std::cout << "] " << (op->operation == BUY_STOCK ? "BOUGHT":"SOLD");
-                std::cout << " " << op->quantity << " shares of " << op->symbol;
-                std::cout << " at " << op->price << std::endl;
+        template <class U> huge_allocator(const huge_allocator<U> &)
+        {
+        }
 
-                op++;
-            }
+        T *allocate(size_t n)
+        {
+            return (T *)huge_pages.allocate(n * sizeof(T));
+        }
 
-            std::cout << std::endl << trade_db.size() << " trading operations in the database" << std::endl ;
+        void deallocate(T *p,size_t n)
+        {
+            huge_pages.release(p,n * sizeof(T));
         }
 
-};
+        template <class U> bool operator==(const huge_allocator<U> &) const
+        {
+            return true;
+        }
 
-/* The GBCE index */
+        template <class U> bool operator!=(const huge_allocator<U> &) const
+        {
+            return false;
+        }
+};
 
-the_index gbce;
+/*
+    A stock symbol or account code: up to 8 characters packed in one
+    integer, first character in the most significant byte and zero
+    padded, so symbols are copied without allocating, compared in one
+    instruction and integer order is alphabetical order.
+*/
 
-/* A function to process commands to test the code */
+#define TICKER_LEN      8
 
-bool process_command(std::string cmdline)
+class ticker
 {
-    std::vector<std::string> cmd;
-    std::istringstream f(cmdline);
-    std::string s;
+    private:
+        uint64_t    code;
 
-    while (getline(f, s, ' '))
-        cmd.push_back(s);
+    public:
 
-    if(cmd.size() > 0)
-    {
+        ticker() : code(0)
+        {
+        }
 
-        if(!cmd[0].compare("quit"))
-            return false;
+        // From the first n characters of s (NUL stops early). Symbols
+        // longer than TICKER_LEN cannot be represented and give an
+        // empty ticker.
 
-        if(!cmd[0].compare("help"))
+        ticker(const char *s,size_t n) : code(0)
         {
-            std::cout << std::endl;
-            std::cout << "COMMANDS:" << std::endl << std::endl;
-            std::cout << "    help   - Show this help." << std::endl;
-            std::cout << "    index  - Show the list of stock and the All-share index." << std::endl;
-            std::cout << "    trade  - Add random trading." << std::endl;
-            std::cout << "    buy    - Buy stock. eg. buy 22 ALE 3.12" << std::endl;
-            std::cout << "    sell   - Sell stock. eg. sell 22 ALE 3.12" << std::endl;
-            std::cout << "    list   - Show trading database." << std::endl;
-            std::cout << "    price  - Recalculate price of stock based on last 15 mins trade" << std::endl;
-            std::cout << "    yield  - Show the dividend yield of all stock" << std::endl;
+            size_t i = 0;
+
+            for(; i < n && s[i]; i++)
+            {
+                if(i == TICKER_LEN)
+                {
+                    code = 0;
+                    return;
+                }
+                code |= (uint64_t)(unsigned char)s[i] << (8 * (TICKER_LEN - 1 - i));
+            }
+        }
+
+        ticker(const char *s) : ticker(s,strlen(s))
+        {
+        }
+
+        ticker(const std::string &s) : ticker(s.c_str(),s.size())
+        {
+        }
+
+        bool empty() const
+        {
+            return code == 0;
+        }
+
+        uint64_t value() const
+        {
+            return code;
+        }
+
+        static ticker from_value(uint64_t v)
+        {
+            ticker t;
+
+            t.code = v;
+            return t;
+        }
+
+        // Write as NUL padded characters (wire format) or a C string
+
+        void copy(char out[TICKER_LEN]) const
+        {
+            for(int i = 0; i < TICKER_LEN; i++)
+                out[i] = (char)(code >> (8 * (TICKER_LEN - 1 - i)));
+        }
+
+        void c_str(char out[TICKER_LEN + 1]) const
+        {
+            copy(out);
+            out[TICKER_LEN] = 0;
+        }
+
+        bool operator==(const ticker &t) const
+        {
+            return code == t.code;
+        }
+
+        bool operator!=(const ticker &t) const
+        {
+            return code != t.code;
+        }
+
+        bool operator<(const ticker &t) const
+        {
+            return code < t.code;
+        }
+};
+
+std::ostream &operator<<(std::ostream &os,const ticker &t)
+{
+    char s[TICKER_LEN + 1];
+
+    t.c_str(s);
+
+    return os << s;
+}
+
+// A command argument as a number, false unless all of it is one and it
+// is finite
+
+bool parse_number(const std::string &s,double &v)
+{
+    char *end;
+
+    v = strtod(s.c_str(),&end);
+
+    return end != s.c_str() && !*end && std::isfinite(v);
+}
+
+/*
+    The engine's clock and random numbers. A command holds the clock at
+    the second it started for as long as it runs, on its own thread only,
+    and random trades come from the engine's own generator, so a journal
+    that records both per command can be replayed to the same results.
+*/
+
+class engine_clock
+{
+    private:
+
+        static thread_local time_t held;    // 0: follow the wall clock
+
+    public:
+
+        time_t now() const
+        {
+            return held ? held : time(NULL);
+        }
+
+        // Holds return what was held before, for release() to put back
+        // when holds nest
+
+        time_t hold(time_t t)
+        {
+            time_t was = held;
+
+            held = t;
+            return was;
+        }
+
+        void release(time_t was = 0)
+        {
+            held = was;
+        }
+};
+
+thread_local time_t engine_clock::held = 0;
+
+engine_clock engine_time;
+
+// xorshift64*, with its whole state in one word so it can be recorded
+
+class engine_random
+{
+    private:
+
+        uint64_t    state;
+
+    public:
+
+        engine_random() : state(0x9e3779b97f4a7c15ULL)
+        {
+        }
+
+        uint64_t get_state() const
+        {
+            return state;
+        }
+
+        void set_state(uint64_t s)
+        {
+            state = s ? s : 0x9e3779b97f4a7c15ULL;
+        }
+
+        uint32_t next()
+        {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+
+            return (uint32_t)((state * 0x2545f4914f6cdd1dULL) >> 32);
+        }
+
+        // Uniform in [0,n)
+
+        uint32_t below(uint32_t n)
+        {
+            return (uint32_t)(((uint64_t)next() * n) >> 32);
+        }
+};
+
+engine_random engine_rng;
+
+// A trade operation record (all members public to ease handling)
+
+class trade_op
+{
+    public:
+        time_t      stamp;
+        ticker      symbol;
+        ticker      account;        // Trading account code, empty if not known
+        int         operation;
+        int         quantity;
+        double      price;
+
+        trade_op(ticker sy,int op,int qty,double pr,ticker acc = ticker())
+        {
+            stamp = engine_time.now();
+            symbol = sy;
+            account = acc;
+            operation = (op == BUY_STOCK) ? BUY_STOCK : SELL_STOCK;
+            quantity = qty;
+            price = pr;
+        }
+
+        // A trade stamped by its source (eg. the exchange feed)
+
+        trade_op(ticker sy,int op,int qty,double pr,time_t st,ticker acc = ticker())
+        {
+            stamp = st;
+            symbol = sy;
+            account = acc;
+            operation = (op == BUY_STOCK) ? BUY_STOCK : SELL_STOCK;
+            quantity = qty;
+            price = pr;
+        }
+};
+
+// An account for generated trades: half the trades come from ten of
+// a thousand accounts
+
+ticker random_account()
+{
+    char code[TICKER_LEN + 1];
+
+    snprintf(code,sizeof(code),"AC%03d",(engine_rng.next() & 1) ? engine_rng.below(10) : engine_rng.below(1000));
+
+    return ticker(code);
+}
+
+// A rudimentary trading database
+
+typedef std::vector<trade_op,huge_allocator<trade_op> > trade_store;
+
+trade_store trade_db;
+
+// Serializes access to trade_db and the index between the command
+// line and the feed handler thread.
+
+std::mutex engine_lock;
+startup_mark startup_store("trade store");
+
+// What an stock needs to know about each trade inside its pricing window
+
+struct trade_ref
+{
+    size_t      id;         // Position in trade_db
+    time_t      stamp;
+    int         quantity;
+    double      price;
+};
+
+// A growable ring buffer of trades, oldest first. Capacity is always
+// a power of two (or none yet) so wrapping is a mask.
+
+class trade_ring
+{
+    private:
+        std::vector<trade_ref,huge_allocator<trade_ref> > buf;
+        size_t      head;
+        size_t      count;
+        uint64_t    base;           // Trades ever popped, the position of front()
+
+        void grow()
+        {
+            std::vector<trade_ref,huge_allocator<trade_ref> > tmp(buf.empty() ? 16 : buf.size() * 2);
+
+            for(size_t i = 0; i < count; i++)
+                tmp[i] = (*this)[i];
+
+            buf.swap(tmp);
+            head = 0;
+        }
+
+    public:
+
+        // No buffer until the first trade, most stocks of a large
+        // universe never trade
+
+        trade_ring() : head(0), count(0), base(0)
+        {
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        // Make room for n trades so pushing them never reallocates
+
+        void reserve(size_t n)
+        {
+            size_t cap = buf.empty() ? 16 : buf.size();
+
+            while(cap < n)
+                cap *= 2;
+
+            if(cap > buf.size())
+            {
+                std::vector<trade_ref,huge_allocator<trade_ref> > tmp(cap);
+
+                for(size_t i = 0; i < count; i++)
+                    tmp[i] = (*this)[i];
+
+                buf.swap(tmp);
+                head = 0;
+            }
+        }
+
+        const trade_ref &front() const
+        {
+            return buf[head];
+        }
+
+        const trade_ref &operator[](size_t i) const
+        {
+            return buf[(head + i) & (buf.size() - 1)];
+        }
+
+        // Trades also have a position that does not move when older ones
+        // are popped, from begin() to end(), so several readers can keep
+        // their own place in the ring.
+
+        uint64_t begin() const
+        {
+            return base;
+        }
+
+        uint64_t end() const
+        {
+            return base + count;
+        }
+
+        const trade_ref &at(uint64_t pos) const
+        {
+            return (*this)[pos - base];
+        }
+
+        void push_back(const trade_ref &t)
+        {
+            if(count == buf.size())
+                grow();
+
+            buf[(head + count) & (buf.size() - 1)] = t;
+            count++;
+        }
+
+        void pop_front()
+        {
+            head = (head + 1) & (buf.size() - 1);
+            count--;
+            base++;
+        }
+
+        void clear()
+        {
+            base += count;
+            head = count = 0;
+        }
+};
+
+/*
+    Pricing windows. Every stock keeps the trades of the longest window
+    in one ring, and each window only adds its own start in that ring and
+    its running sums, so one more window costs 24 bytes per stock and the
+    trades leaving it rather than another scan. One of the windows is the
+    one stock prices and the index are based on.
+
+    The same ring also keeps a time weighted price per window, and the
+    running sums of the last trades and of the last bucket of shares, so
+    every pricing method is always up to date and they can be compared
+    live. Trades older than the longest window are not counted by any.
+*/
+
+#define MAX_WINDOWS     8
+#define MAX_WINDOW_LEN  (12 * 3600)     // A trading day
+#define DEFAULT_WINDOW  (15 * 60)
+#define DEFAULT_LAST    20              // Trades in the last trades average
+#define DEFAULT_BUCKET  1000            // Shares in the volume bucket
+
+// How a stock's price is made from its trades
+
+enum
+{
+    PRICE_VWAP = 0,     // Volume weighted over the pricing window
+    PRICE_TWAP,         // Time weighted over the pricing window
+    PRICE_VOLUME,       // Volume weighted over the last bucket of shares
+    PRICE_LAST,         // Mean price of the last trades
+    PRICE_METHODS
+};
+
+const char *method_names[PRICE_METHODS] = { "vwap", "twap", "volume", "last" };
+
+class window_config
+{
+    private:
+
+        size_t      count;
+        time_t      length[MAX_WINDOWS];    // Seconds, ascending
+        size_t      pricing;                // The window prices come from
+        size_t      last_trades;
+        uint32_t    bucket_shares;
+
+    public:
+
+        window_config() : count(1), pricing(0), last_trades(DEFAULT_LAST), bucket_shares(DEFAULT_BUCKET)
+        {
+            length[0] = DEFAULT_WINDOW;
+        }
+
+        size_t get_last_trades() const
+        {
+            return last_trades;
+        }
+
+        uint32_t get_bucket_shares() const
+        {
+            return bucket_shares;
+        }
+
+        // Stocks must reset their windows after these change
+
+        bool set_last_trades(size_t n)
+        {
+            if(!n)
+                return false;
+
+            last_trades = n;
+            return true;
+        }
+
+        bool set_bucket_shares(long n)
+        {
+            if(n <= 0 || n > 0xffffffffL)
+                return false;
+
+            bucket_shares = n;
+            return true;
+        }
+
+        static int method(const std::string &name)
+        {
+            for(int m = 0; m < PRICE_METHODS; m++)
+                if(!name.compare(method_names[m]))
+                    return m;
+
+            return -1;
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        time_t operator[](size_t w) const
+        {
+            return length[w];
+        }
+
+        size_t get_pricing() const
+        {
+            return pricing;
+        }
+
+        time_t longest() const
+        {
+            return length[count - 1];
+        }
+
+        // Which window has this length, or -1
+
+        int find(time_t secs) const
+        {
+            for(size_t w = 0; w < count; w++)
+                if(length[w] == secs)
+                    return w;
+
+            return -1;
+        }
+
+        // Replace the windows; prices keep coming from the same length if
+        // it is still there, else from 'price' or the first window.
+
+        bool set(std::vector<time_t> secs,time_t price = 0)
+        {
+            time_t current = length[pricing];
+
+            std::sort(secs.begin(),secs.end());
+            secs.erase(std::unique(secs.begin(),secs.end()),secs.end());
+
+            if(secs.empty() || secs.size() > MAX_WINDOWS || secs[0] <= 0 || secs.back() > MAX_WINDOW_LEN)
+                return false;
+
+            count = secs.size();
+            std::copy(secs.begin(),secs.end(),length);
+
+            int w = find(price ? price : current);
+
+            pricing = (w < 0) ? 0 : w;
+            return true;
+        }
+
+        bool set_pricing(time_t secs)
+        {
+            int w = find(secs);
+
+            if(w < 0)
+                return false;
+
+            pricing = w;
+            return true;
+        }
+
+        // "90", "90s", "5m" or "1h" to seconds, 0 if not a length
+
+        static time_t parse(const std::string &text)
+        {
+            char *end;
+            long n = strtol(text.c_str(),&end,10);
+
+            if(end == text.c_str() || n <= 0)
+                return 0;
+
+            if(!strcmp(end,"") || !strcmp(end,"s"))
+                return n;
+
+            if(!strcmp(end,"m"))
+                return n * 60;
+
+            if(!strcmp(end,"h"))
+                return n * 3600;
+
+            return 0;
+        }
+
+        static std::string name(time_t secs)
+        {
+            std::ostringstream os;
+
+            if(secs % 3600 == 0)
+                os << secs / 3600 << "h";
+            else if(secs % 60 == 0)
+                os << secs / 60 << "m";
+            else
+                os << secs << "s";
+
+            return os.str();
+        }
+
+        void show() const
+        {
+            for(size_t w = 0; w < count; w++)
+                std::cout << (w ? " " : "") << name(length[w]) << (w == pricing ? "*" : "");
+
+            std::cout << " (* prices the index), last " << last_trades << " trades, ";
+            std::cout << bucket_shares << " share bucket" << std::endl;
+        }
+};
+
+window_config windows;
+
+/*
+    Volume at price. Each stock keeps today's shares traded per price
+    level (tick size buckets, named by their lowest price) in a dense
+    array over the range traded,
+    with a Fenwick tree over it, so a trade costs one array add and a
+    logarithmic tree update, and any volume percentile of price (median,
+    value area) is a logarithmic descent of the tree. The point of
+    control, the busiest level, is kept as trades come in. A stock that
+    trades over too wide a range gets a coarser tick.
+*/
+
+#define PROFILE_TICK    0.01
+#define PROFILE_LEVELS  (1 << 16)       // Most levels per stock before coarsening
+#define PROFILE_LIMIT   4.0e18          // Furthest level from zero a price may map to
+
+double profile_tick = PROFILE_TICK;
+
+class volume_profile
+{
+    private:
+
+        double      tick;
+        int64_t     base;               // Level of slot 0
+        std::vector<double> levels;     // Shares per level
+        std::vector<double> tree;       // Fenwick tree of 'levels', 1 based
+        double      total;
+        size_t      poc;                // Slot of the busiest level
+
+        void rebuild()
+        {
+            tree.assign(levels.size() + 1,0.0);
+
+            for(size_t i = 1; i <= levels.size(); i++)
+            {
+                tree[i] += levels[i - 1];
+
+                size_t up = i + (i & -i);
+
+                if(up <= levels.size())
+                    tree[up] += tree[i];
+            }
+        }
+
+        // Make room for level 'l', doubling the range so growth is amortized
+
+        void cover(int64_t l)
+        {
+            if(levels.empty())
+            {
+                base = l;
+                levels.assign(1,0.0);
+                tree.assign(2,0.0);
+                return;
+            }
+
+            int64_t lo = std::min(base,l),hi = std::max(base + (int64_t)levels.size(),l + 1);
+
+            if(lo == base && hi == base + (int64_t)levels.size())
+                return;
+
+            size_t n = std::max((size_t)(hi - lo),levels.size() * 2);
+
+            // Grow towards the side that needed it
+
+            if(l < base)
+                lo = hi - n;
+
+            std::vector<double> moved(n,0.0);
+
+            std::copy(levels.begin(),levels.end(),moved.begin() + (base - lo));
+            poc += base - lo;
+            base = lo;
+            levels.swap(moved);
+            rebuild();
+        }
+
+        // Move every level to another tick, prices divided by 'ratio' and
+        // shares multiplied by it
+
+        void rebucket(double new_tick,double ratio)
+        {
+            std::vector<double> old;
+            int64_t old_base = base;
+            double old_tick = tick;
+
+            old.swap(levels);
+            tree.clear();
+            total = 0.0;
+            poc = 0;
+            tick = new_tick;
+
+            for(size_t i = 0; i < old.size(); i++)
+                if(old[i] > 0)
+                    add((old_base + (int64_t)i) * old_tick / ratio,old[i] * ratio);
+        }
+
+    public:
+
+        volume_profile() : tick(profile_tick), base(0), total(0.0), poc(0)
+        {
+        }
+
+        void add(double price,double shares)
+        {
+            double level = floor(price / tick + 1e-9);
+
+            // Levels are kept well inside int64 so the range sums below
+            // can't overflow
+
+            if(!std::isfinite(level) || !std::isfinite(shares) || fabs(level) > PROFILE_LIMIT)
+                return;
+
+            int64_t l = (int64_t)level;
+
+            // Too wide a range: double the tick until it fits
+
+            while(!levels.empty() && std::max(base + (int64_t)levels.size(),l + 1) - std::min(base,l) > PROFILE_LEVELS)
+            {
+                rebucket(tick * 2,1.0);
+                l = (int64_t)floor(price / tick + 1e-9);
+            }
+
+            cover(l);
+
+            size_t i = l - base;
+
+            levels[i] += shares;
+            total += shares;
+
+            for(size_t j = i + 1; j <= levels.size(); j += j & -j)
+                tree[j] += shares;
+
+            if(levels[i] > levels[poc])
+                poc = i;
+        }
+
+        void clear()
+        {
+            levels.clear();
+            tree.clear();
+            total = 0.0;
+            poc = 0;
+            tick = profile_tick;
+        }
+
+        void split(double ratio)
+        {
+            rebucket(tick,ratio);
+        }
+
+        void set_tick(double t)
+        {
+            rebucket(t,1.0);
+        }
+
+        double get_tick() const
+        {
+            return tick;
+        }
+
+        double volume() const
+        {
+            return total;
+        }
+
+        size_t range() const
+        {
+            return levels.size();
+        }
+
+        double price_of(size_t i) const
+        {
+            return (base + (int64_t)i) * tick;
+        }
+
+        double at(size_t i) const
+        {
+            return levels[i];
+        }
+
+        // The busiest level
+
+        size_t point_of_control() const
+        {
+            return poc;
+        }
+
+        // The lowest level with at least a fraction q of the volume at or
+        // below it, by descending the tree
+
+        size_t percentile(double q) const
+        {
+            double want = q * total,sum = 0.0;
+            size_t pos = 0,step = 1;
+
+            while(step * 2 <= levels.size())
+                step *= 2;
+
+            for(; step; step /= 2)
+            {
+                if(pos + step <= levels.size() && sum + tree[pos + step] < want)
+                {
+                    pos += step;
+                    sum += tree[pos];
+                }
+            }
+
+            return std::min(pos,levels.size() - 1);
+        }
+};
+
+/*
+    Streaming quantiles (KLL sketches). Values go into a stack of
+    compactors; when one fills up it is sorted and every other value,
+    from a random start, moves a level up where it counts double. The
+    lower levels are kept smaller than the upper ones, so a sketch holds
+    at most about 3 * KLL_K values whatever it has seen, a value costs amortized
+    constant work apart from the occasional sort, and the rank error is
+    about 1.7% with KLL_K 200. Sketches with the same K merge by pooling
+    their levels, so shards or symbols add up to universe-wide figures.
+*/
+
+#define KLL_K           200
+#define KLL_MIN_LEVEL   8               // Smallest compactor
+
+class kll_sketch
+{
+    private:
+
+        std::vector<std::vector<float> > levels;
+        uint64_t    n;                  // Values seen
+        size_t      items;              // Values kept
+        size_t      room;               // Values kept before compacting
+        uint32_t    coin;               // xorshift state for the random start
+        float       lo;
+        float       hi;
+
+        size_t capacity(size_t h) const
+        {
+            double c = KLL_K * pow(2.0 / 3.0,(double)(levels.size() - 1 - h));
+
+            return std::max((size_t)KLL_MIN_LEVEL,(size_t)c);
+        }
+
+        void grow()
+        {
+            levels.push_back(std::vector<float>());
+
+            room = 0;
+            for(size_t h = 0; h < levels.size(); h++)
+                room += capacity(h);
+        }
+
+        // Halve the lowest full level into the one above
+
+        void compress()
+        {
+            for(size_t h = 0; h < levels.size(); h++)
+            {
+                if(levels[h].size() < capacity(h))
+                    continue;
+
+                if(h + 1 == levels.size())
+                    grow();
+
+                std::vector<float> &c = levels[h];
+                size_t m = c.size() & ~(size_t)1;
+
+                coin ^= coin << 13;
+                coin ^= coin >> 17;
+                coin ^= coin << 5;
+
+                std::sort(c.begin(),c.end());
+
+                for(size_t i = coin & 1; i < m; i += 2)
+                    levels[h + 1].push_back(c[i]);
+
+                // An odd one out stays where it is
+
+                c.erase(c.begin(),c.begin() + m);
+                items -= m / 2;
+
+                return;
+            }
+        }
+
+    public:
+
+        kll_sketch() : n(0), items(0), room(0), coin(2463534242U), lo(0), hi(0)
+        {
+        }
+
+        uint64_t count() const
+        {
+            return n;
+        }
+
+        size_t retained() const
+        {
+            return items;
+        }
+
+        void clear()
+        {
+            levels.clear();
+            n = items = room = 0;
+        }
+
+        void update(float x)
+        {
+            if(levels.empty())
+                grow();
+
+            lo = n ? std::min(lo,x) : x;
+            hi = n ? std::max(hi,x) : x;
+
+            levels[0].push_back(x);
+            n++;
+
+            if(++items >= room)
+                compress();
+        }
+
+        void merge(const kll_sketch &other)
+        {
+            if(!other.n)
+                return;
+
+            lo = n ? std::min(lo,other.lo) : other.lo;
+            hi = n ? std::max(hi,other.hi) : other.hi;
+
+            while(levels.size() < other.levels.size())
+                grow();
+
+            for(size_t h = 0; h < other.levels.size(); h++)
+                levels[h].insert(levels[h].end(),other.levels[h].begin(),other.levels[h].end());
+
+            n += other.n;
+            items += other.items;
+
+            while(items >= room)
+            {
+                size_t before = items;
+
+                compress();
+
+                if(items == before)
+                    grow();
+            }
+        }
+
+        // Multiply every value by f > 0 (a split changes prices and sizes)
+
+        void scale(float f)
+        {
+            for(size_t h = 0; h < levels.size(); h++)
+                for(size_t i = 0; i < levels[h].size(); i++)
+                    levels[h][i] *= f;
+
+            lo *= f;
+            hi *= f;
+        }
+
+        // The value with a fraction q of the values below it
+
+        float quantile(double q) const
+        {
+            std::vector<std::pair<float,uint64_t> > all;
+
+            if(!n)
+                return 0;
+
+            if(q <= 0)
+                return lo;
+
+            if(q >= 1)
+                return hi;
+
+            all.reserve(items);
+
+            for(size_t h = 0; h < levels.size(); h++)
+                for(size_t i = 0; i < levels[h].size(); i++)
+                    all.push_back(std::make_pair(levels[h][i],(uint64_t)1 << h));
+
+            std::sort(all.begin(),all.end());
+
+            uint64_t total = 0,want;
+
+            for(size_t i = 0; i < all.size(); i++)
+                total += all[i].second;
+
+            want = (uint64_t)(q * total);
+
+            for(size_t i = 0,seen = 0; i < all.size(); i++)
+            {
+                seen += all[i].second;
+
+                if(seen > want)
+                    return all[i].first;
+            }
+
+            return hi;
+        }
+};
+
+/*
+    Who trades a stock. Distinct accounts are counted by a HyperLogLog
+    sketch (1024 one byte registers, about 3% error) and the accounts
+    with the most volume are found by a space-saving summary of
+    HH_SLOTS counters, which never underestimates an account's volume
+    and overestimates it by at most the error it reports. Both take a
+    fixed amount of memory per stock whatever the number of accounts,
+    and both merge, registers by maximum and summaries by adding counts
+    over the union of accounts and keeping the largest.
+*/
+
+#define HLL_BITS        10
+#define HLL_REGISTERS   (1 << HLL_BITS)
+#define HH_SLOTS        32
+
+// Spread the bits of a 64 bit code (splitmix64 finalizer)
+
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+class hyperloglog
+{
+    private:
+
+        uint8_t     reg[HLL_REGISTERS];
+
+    public:
+
+        hyperloglog()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            memset(reg,0,sizeof(reg));
+        }
+
+        void update(uint64_t code)
+        {
+            uint64_t h = mix64(code);
+            uint8_t rank = 1;
+
+            // Leading zeros after the register bits, plus one
+
+            for(uint64_t rest = h << HLL_BITS; rank <= 64 - HLL_BITS && !(rest & (1ULL << 63)); rest <<= 1)
+                rank++;
+
+            reg[h >> (64 - HLL_BITS)] = std::max(reg[h >> (64 - HLL_BITS)],rank);
+        }
+
+        void merge(const hyperloglog &other)
+        {
+            for(int i = 0; i < HLL_REGISTERS; i++)
+                reg[i] = std::max(reg[i],other.reg[i]);
+        }
+
+        double estimate() const
+        {
+            double sum = 0.0,m = HLL_REGISTERS;
+            int zeros = 0;
+
+            for(int i = 0; i < HLL_REGISTERS; i++)
+            {
+                sum += ldexp(1.0,-reg[i]);
+                zeros += !reg[i];
+            }
+
+            double e = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+
+            // Small counts are better told by the empty registers
+
+            if(e <= 2.5 * m && zeros)
+                e = m * log(m / zeros);
+
+            return e;
+        }
+};
+
+class heavy_hitters
+{
+    public:
+
+        struct counter
+        {
+            ticker      key;
+            double      count;          // Volume, at least the true one
+            double      error;          // By at most this
+        };
+
+    private:
+
+        counter     slot[HH_SLOTS];
+        size_t      used;
+
+        // The count an account not in the summary may have
+
+        double floor() const
+        {
+            if(used < HH_SLOTS)
+                return 0.0;
+
+            double low = slot[0].count;
+
+            for(size_t i = 1; i < used; i++)
+                low = std::min(low,slot[i].count);
+
+            return low;
+        }
+
+    public:
+
+        heavy_hitters() : used(0)
+        {
+        }
+
+        void clear()
+        {
+            used = 0;
+        }
+
+        void update(ticker key,double weight)
+        {
+            size_t low = 0;
+
+            for(size_t i = 0; i < used; i++)
+            {
+                if(slot[i].key == key)
+                {
+                    slot[i].count += weight;
+                    return;
+                }
+
+                if(slot[i].count < slot[low].count)
+                    low = i;
+            }
+
+            if(used < HH_SLOTS)
+            {
+                slot[used].key = key;
+                slot[used].count = weight;
+                slot[used].error = 0.0;
+                used++;
+                return;
+            }
+
+            // Take over the smallest counter, which may have been ours
+
+            slot[low].key = key;
+            slot[low].error = slot[low].count;
+            slot[low].count += weight;
+        }
+
+        void merge(const heavy_hitters &other)
+        {
+            std::vector<counter> all;
+            double mine = floor(),theirs = other.floor();
+
+            for(size_t i = 0; i < used; i++)
+            {
+                counter c = slot[i];
+                size_t j = 0;
+
+                while(j < other.used && other.slot[j].key != c.key)
+                    j++;
+
+                c.count += (j < other.used) ? other.slot[j].count : theirs;
+                c.error += (j < other.used) ? other.slot[j].error : theirs;
+                all.push_back(c);
+            }
+
+            for(size_t j = 0; j < other.used; j++)
+            {
+                size_t i = 0;
+
+                while(i < used && slot[i].key != other.slot[j].key)
+                    i++;
+
+                if(i < used)
+                    continue;
+
+                counter c = other.slot[j];
+
+                c.count += mine;
+                c.error += mine;
+                all.push_back(c);
+            }
+
+            used = std::min(all.size(),(size_t)HH_SLOTS);
+            std::partial_sort(all.begin(),all.begin() + used,all.end(),by_count);
+            std::copy(all.begin(),all.begin() + used,slot);
+        }
+
+        // Volumes are in today's shares
+
+        void split(double ratio)
+        {
+            for(size_t i = 0; i < used; i++)
+            {
+                slot[i].count *= ratio;
+                slot[i].error *= ratio;
+            }
+        }
+
+        // The n accounts with the most volume, largest first
+
+        std::vector<counter> top(size_t n) const
+        {
+            std::vector<counter> out(slot,slot + used);
+
+            n = std::min(n,out.size());
+            std::partial_sort(out.begin(),out.begin() + n,out.end(),by_count);
+            out.resize(n);
+
+            return out;
+        }
+
+        static bool by_count(const counter &a,const counter &b)
+        {
+            return a.count > b.count;
+        }
+};
+
+// Trade size and price distributions of a stock over some time, and
+// the accounts that traded it
+
+struct trade_sketches
+{
+    kll_sketch  size;
+    kll_sketch  price;
+    hyperloglog accounts;
+    heavy_hitters leaders;              // By volume
+
+    void update(double quantity,double p,ticker account)
+    {
+        size.update(quantity);
+        price.update(p);
+
+        if(!account.empty())
+        {
+            accounts.update(account.value());
+            leaders.update(account,quantity);
+        }
+    }
+
+    void merge(const trade_sketches &other)
+    {
+        size.merge(other.size);
+        price.merge(other.price);
+        accounts.merge(other.accounts);
+        leaders.merge(other.leaders);
+    }
+
+    void split(double ratio)
+    {
+        size.scale(ratio);
+        price.scale(1.0 / ratio);
+        leaders.split(ratio);
+    }
+
+    void clear()
+    {
+        size.clear();
+        price.clear();
+        accounts.clear();
+        leaders.clear();
+    }
+};
+
+// A stock's trading over a session, in the shares at its close
+
+struct day_bar
+{
+    int         day;            // YYYYMMDD
+    ticker      symbol;
+    double      open;
+    double      high;
+    double      low;
+    double      close;
+    double      volume;
+    double      value;
+    uint32_t    trades;
+};
+
+// An entry to the GBCE index
+
+class stock
+{
+    private:
+
+        ticker      symbol;
+        int         type;
+        double      last_dividend;
+        double      fixed_dividend;
+        double      par_value;
+        double      price;
+
+        // Splits since startup, oldest first. Trades before a split keep
+        // their recorded price and quantity and are adjusted when read.
+
+        struct split_event
+        {
+            size_t  first_id;       // First trade_db position after the split
+            double  ratio;          // New shares per old share
+        };
+
+        std::vector<split_event> splits;
+
+        // Trades of this stock inside the longest window, and where each
+        // window starts in them with its sums, so a new price costs the
+        // trades that expired instead of a scan of the whole trade_db.
+
+        struct window_sums
+        {
+            uint64_t    start;          // First trade of the window in 'trades'
+            double      value;
+            double      volume;
+            double      area;           // Price times the time it held, up to the last trade
+        };
+
+        trade_ring  trades;
+        window_sums sums[MAX_WINDOWS];
+
+        day_bar     today;
+        volume_profile profile;
+
+        // Trade size and price quantiles today, and in tumbling windows
+        // of the pricing window's length: the current and the last one.
+        // Nearly 6KB, so only allocated once the stock trades.
+
+        struct stock_sketches
+        {
+            trade_sketches day;
+            trade_sketches window;
+            trade_sketches last_window;
+        };
+
+        std::unique_ptr<stock_sketches> sketches;
+        time_t      window_id;          // Start of the current window / its length
+
+        // The last trades and the last bucket of shares, also in 'trades'
+
+        uint64_t    last_start;
+        double      last_sum;           // Of prices
+        uint64_t    bucket_start;
+        double      bucket_value;
+        double      bucket_volume;
+
+        // Shares and price of a trade in today's shares
+
+        double shares(const trade_ref &t) const
+        {
+            return t.quantity * (splits.empty() ? 1.0 : adjustment(t.id));
+        }
+
+        double today_price(const trade_ref &t) const
+        {
+            return splits.empty() ? t.price : t.price / adjustment(t.id);
+        }
+
+        // Add the trade at 'pos', the newest in the ring, to every sum
+
+        void account(uint64_t pos)
+        {
+            const trade_ref &t = trades.at(pos);
+
+            for(size_t w = 0; w < windows.size(); w++)
+            {
+                window_sums &ws = sums[w];
+
+                // The previous trade's price held until this one
+
+                if(ws.start != pos)
+                    ws.area += today_price(trades.at(pos - 1)) * (t.stamp - trades.at(pos - 1).stamp);
+
+                ws.value += (t.quantity * t.price);
+                ws.volume += shares(t);
+            }
+
+            last_sum += today_price(t);
+
+            while(pos + 1 - last_start > windows.get_last_trades())
+                last_sum -= today_price(trades.at(last_start++));
+
+            bucket_value += (t.quantity * t.price);
+            bucket_volume += shares(t);
+            trim_bucket();
+        }
+
+        // Drop the oldest trades of the bucket while the rest still fill it
+
+        void trim_bucket()
+        {
+            while(bucket_start + 1 < trades.end() &&
+                  bucket_volume - shares(trades.at(bucket_start)) >= windows.get_bucket_shares())
+            {
+                const trade_ref &t = trades.at(bucket_start++);
+
+                bucket_value -= (t.quantity * t.price);
+                bucket_volume -= shares(t);
+            }
+        }
+
+    public:
+
+        stock(ticker sy,int ty,double ld,double fd,double pv)
+        {
+            symbol = sy;
+            type = (ty==PREF_STOCK) ? ty : COMMON_STOCK;
+            last_dividend = ld;
+            fixed_dividend = fd;
+
+            // Initial price same than par value.
+
+            par_value = price = pv;
+
+            today.symbol = sy;
+            today.trades = 0;
+            window_id = 0;
+            today.volume = today.value = 0.0;
+
+            reset_windows();
+        }
+
+        ticker get_symbol() const
+        {
+            return symbol;
+        }
+
+        double get_price() const
+        {
+            return price;
+        }
+
+        double get_fixed_dividend() const
+        {
+            return fixed_dividend;
+        }
+
+        double get_par_value() const
+        {
+            return par_value;
+        }
+
+        double get_last_dividend() const
+        {
+            return last_dividend;
+        }
+
+        const volume_profile &get_profile() const
+        {
+            return profile;
+        }
+
+        const trade_sketches &get_day_sketches() const
+        {
+            static const trade_sketches none;
+
+            return sketches ? sketches->day : none;
+        }
+
+        // The sketches of the tumbling window 'now' is in and of the one
+        // before, empty ones for windows without trades
+
+        void window_sketches(time_t now,const trade_sketches *&current,const trade_sketches *&last) const
+        {
+            static const trade_sketches none;
+            time_t id = now / windows[windows.get_pricing()];
+
+            current = last = &none;
+
+            if(!sketches)
+                return;
+
+            current = (id == window_id) ? &sketches->window : &none;
+            last = (id == window_id) ? &sketches->last_window : (id == window_id + 1) ? &sketches->window : &none;
+        }
+
+        void set_profile_tick(double t)
+        {
+            profile.set_tick(t);
+        }
+
+        // The dividend the yield is based on
+
+        double get_yield_dividend() const
+        {
+            return (type == PREF_STOCK) ? fixed_dividend : last_dividend;
+        }
+
+        // This stock's share of the index: the log of its price (zero
+        // prices are left out of the product, see the_index::get_index)
+
+        double contribution() const
+        {
+            return price ? log(price) : 0.0;
+        }
+
+        // A dividend announcement
+
+        void set_dividend(double ld,double fd)
+        {
+            last_dividend = ld;
+            fixed_dividend = fd;
+        }
+
+        // A split giving 'ratio' new shares per old one. Only the current
+        // figures change here; trades before it are adjusted on read.
+
+        void split(double ratio,size_t first_id)
+        {
+            split_event e;
+
+            e.first_id = first_id;
+            e.ratio = ratio;
+            splits.push_back(e);
+
+            par_value /= ratio;
+            price /= ratio;
+            last_dividend /= ratio;
+
+            // Notional is unchanged, shares in the windows multiply and
+            // prices divide
+
+            for(size_t w = 0; w < windows.size(); w++)
+            {
+                sums[w].volume *= ratio;
+                sums[w].area /= ratio;
+            }
+
+            last_sum /= ratio;
+            bucket_volume *= ratio;
+            trim_bucket();
+
+            today.open /= ratio;
+            today.high /= ratio;
+            today.low /= ratio;
+            today.close /= ratio;
+            today.volume *= ratio;
+            profile.split(ratio);
+
+            if(sketches)
+            {
+                sketches->day.split(ratio);
+                sketches->window.split(ratio);
+                sketches->last_window.split(ratio);
+            }
+        }
+
+        // Shares today (or after the first 'upto' splits) per share at
+        // the time of trade 'id'
+
+        double adjustment(size_t id,size_t upto = ~(size_t)0) const
+        {
+            double r = 1.0;
+
+            for(size_t i = std::min(upto,splits.size()); i > 0 && splits[i - 1].first_id > id; i--)
+                r *= splits[i - 1].ratio;
+
+            return r;
+        }
+
+        size_t split_count() const
+        {
+            return splits.size();
+        }
+
+        // Make room for n trades in the longest window
+
+        void reserve(size_t n)
+        {
+            trades.reserve(n);
+        }
+
+        // Account a new trade of this stock (id is its position in trade_db)
+
+        void add_trade(const trade_op &op,size_t id)
+        {
+            trade_ref t;
+
+            t.id = id;
+            t.stamp = op.stamp;
+            t.quantity = op.quantity;
+            t.price = op.price;
+
+            trades.push_back(t);
+            account(trades.end() - 1);
+
+            if(!today.trades++)
+                today.open = today.high = today.low = op.price;
+
+            today.high = std::max(today.high,op.price);
+            today.low = std::min(today.low,op.price);
+            today.close = op.price;
+            today.volume += op.quantity;
+            today.value += op.quantity * op.price;
+            profile.add(op.price,op.quantity);
+
+            // Roll the tumbling window, an empty one if a whole one passed
+
+            time_t w = op.stamp / windows[windows.get_pricing()];
+
+            if(!sketches)
+                sketches.reset(new stock_sketches);
+
+            if(w != window_id)
+            {
+                sketches->last_window.clear();
+
+                if(w == window_id + 1)
+                    std::swap(sketches->last_window,sketches->window);
+
+                sketches->window.clear();
+                window_id = w;
+            }
+
+            sketches->day.update(op.quantity,op.price,op.account);
+            sketches->window.update(op.quantity,op.price,op.account);
+        }
+
+        // End the session: hand over its bar and start the next one with
+        // no trades, so windows do not reach back over the close. The
+        // price carries over. Splits only matter to the trades dropped.
+
+        day_bar close_day(int day)
+        {
+            day_bar b = today;
+
+            b.day = day;
+
+            if(!b.trades)
+                b.open = b.high = b.low = b.close = price;
+
+            today.trades = 0;
+            today.volume = today.value = 0.0;
+            profile.clear();
+            if(sketches)
+            {
+                sketches->day.clear();
+                sketches->window.clear();
+                sketches->last_window.clear();
+            }
+            window_id = 0;
+
+            trades.clear();
+            splits.clear();
+            reset_windows();
+
+            return b;
+        }
+
+        // Restart every sum from the trades kept, after the windows
+        // changed. A longer window than before only has the trades the
+        // old longest one kept until new ones come in.
+
+        void reset_windows()
+        {
+            for(size_t w = 0; w < windows.size(); w++)
+            {
+                sums[w].start = trades.begin();
+                sums[w].value = sums[w].volume = sums[w].area = 0.0;
+            }
+
+            last_start = bucket_start = trades.begin();
+            last_sum = bucket_value = bucket_volume = 0.0;
+
+            for(uint64_t pos = trades.begin(); pos != trades.end(); pos++)
+                account(pos);
+
+            expire(engine_time.now());
+        }
+
+        // Take the trades older than each window out of its sums. Trades
+        // are added in time order, so the ones falling out of a window
+        // are always at its start; the ring drops them once the longest
+        // window has.
+
+        void expire(time_t now)
+        {
+            for(size_t w = 0; w < windows.size(); w++)
+            {
+                window_sums &ws = sums[w];
+
+                //  This is not the way to calculate time lapses
+                //  in the real world but its OK for this test.
+
+                while(ws.start != trades.end() && windows[w] < (now - trades.at(ws.start).stamp))
+                {
+                    const trade_ref &t = trades.at(ws.start++);
+
+                    ws.value -= (t.quantity * t.price);
+                    ws.volume -= shares(t);
+
+                    if(ws.start != trades.end())
+                        ws.area -= today_price(t) * (trades.at(ws.start).stamp - t.stamp);
+                }
+
+                // Restart the sums when the window empties so rounding
+                // errors do not build up
+
+                if(ws.start == trades.end())
+                    ws.value = ws.volume = ws.area = 0.0;
+            }
+
+            uint64_t keep = sums[windows.size() - 1].start;
+
+            while(last_start < keep)
+                last_sum -= today_price(trades.at(last_start++));
+
+            while(bucket_start < keep)
+            {
+                const trade_ref &t = trades.at(bucket_start++);
+
+                bucket_value -= (t.quantity * t.price);
+                bucket_volume -= shares(t);
+            }
+
+            if(keep == trades.end())
+                last_sum = bucket_value = bucket_volume = 0.0;
+
+            while(!trades.empty() && trades.begin() < keep)
+                trades.pop_front();
+        }
+
+        // Volume weighted price over window w, false if it had no trading
+
+        bool window_price(size_t w,double &vwap) const
+        {
+            if(sums[w].start == trades.end())
+                return false;
+
+            vwap = sums[w].value / sums[w].volume;
+            return true;
+        }
+
+        // The same over a length that is not one of the windows, by a scan
+        // of the trades kept. Lengths past the longest window only see
+        // the trades in it.
+
+        bool window_price(time_t interval,time_t now,double &vwap) const
+        {
+            double value = 0.0,volume = 0.0;
+
+            for(uint64_t pos = trades.end(); pos != trades.begin(); pos--)
+            {
+                const trade_ref &t = trades.at(pos - 1);
+
+                if(interval < (now - t.stamp))
+                    break;
+
+                value += t.quantity * t.price;
+                volume += shares(t);
+            }
+
+            if(volume == 0.0)
+                return false;
+
+            vwap = value / volume;
+            return true;
+        }
+
+        // Time weighted price over window w: each trade's price holds
+        // until the next one, the last one until now. With no time
+        // between the first trade and now that is the last price.
+
+        bool time_price(size_t w,time_t now,double &twap) const
+        {
+            if(sums[w].start == trades.end())
+                return false;
+
+            const trade_ref &first = trades.at(sums[w].start),&last = trades.at(trades.end() - 1);
+
+            now = std::max(now,last.stamp);
+
+            if(now == first.stamp)
+                twap = today_price(last);
+            else
+                twap = (sums[w].area + today_price(last) * (now - last.stamp)) / (now - first.stamp);
+
+            return true;
+        }
+
+        // Volume weighted price of the last bucket of shares, counting
+        // only the part of its oldest trade that fits in the bucket
+
+        bool bucket_price(double &vwap) const
+        {
+            if(bucket_start == trades.end())
+                return false;
+
+            double excess = bucket_volume - windows.get_bucket_shares();
+
+            if(excess > 0)
+                vwap = (bucket_value - excess * today_price(trades.at(bucket_start))) / windows.get_bucket_shares();
+            else
+                vwap = bucket_value / bucket_volume;
+
+            return true;
+        }
+
+        // Mean price of the last trades
+
+        bool last_price(double &mean) const
+        {
+            if(last_start == trades.end())
+                return false;
+
+            mean = last_sum / (trades.end() - last_start);
+            return true;
+        }
+
+        // Any of the above, windowed methods over window w
+
+        bool method_price(int method,size_t w,time_t now,double &p) const
+        {
+            switch(method)
+            {
+                case PRICE_TWAP:    return time_price(w,now,p);
+                case PRICE_VOLUME:  return bucket_price(p);
+                case PRICE_LAST:    return last_price(p);
+                default:            return window_price(w,p);
+            }
+        }
+
+        // The trades a price by this method comes from (for provenance)
+
+        void method_span(int method,uint32_t &count,uint64_t &first_id,uint64_t &last_id) const
+        {
+            uint64_t start;
+
+            switch(method)
+            {
+                case PRICE_VOLUME:  start = bucket_start; break;
+                case PRICE_LAST:    start = last_start; break;
+                default:            start = sums[windows.get_pricing()].start; break;
+            }
+
+            count = trades.end() - start;
+            first_id = count ? trades.at(start).id : 0;
+            last_id = count ? trades.at(trades.end() - 1).id : 0;
+        }
+
+        // Set the price of the stock from its trading by a method, over
+        // the pricing window for the windowed ones, as at 'now'. Only
+        // modify price if there was trading.
+
+        double set_price(int method,time_t now)
+        {
+            expire(now);
+            method_price(method,windows.get_pricing(),now,price);
+
+            return price;
+        }
+
+        // Show an stock
+
+        void show() const
+        {
+            std::cout << std::setw(3) << symbol << " ";
+            std::cout << std::setw(4) << (type==PREF_STOCK ? "PREF" : "COMM") << " ";
+            std::cout << std::setw(8) << last_dividend << " ";
+            std::cout << std::setw(3) << fixed_dividend << " ";
+            std::cout << std::setw(8) << par_value << " ";
+            std::cout << std::setw(8) << price << std::endl;
+        }
+};
+
+
+/*
+    Per stock figures as columns, one row per stock in index order, so
+    the dividend yield and P/E ratio of the whole universe come from one
+    pass over contiguous memory that the compiler turns into SIMD code.
+    Zero denominators are masked to a zero ratio rather than branched on.
+*/
+
+// Columns that can be screened
+
+enum
+{
+    FIELD_PRICE = 0,
+    FIELD_YIELD,
+    FIELD_PE,
+    FIELD_DIVIDEND,
+    FIELD_VOLUME,
+    FIELDS
+};
+
+const char *field_names[FIELDS] = { "price", "yield", "pe", "dividend", "volume" };
+
+class stock_metrics
+{
+    public:
+
+        typedef std::vector<double,huge_allocator<double> > column;
+
+        column      price;
+        column      yield_dividend;     // Last dividend, or the fixed one for preferred stock
+        column      last_dividend;
+        column      yield;
+        column      pe;
+        column      volume;             // Shares traded today
+
+        // Bumped on every change to the ratio columns and to volume, so
+        // anything derived from them knows when it is stale.
+
+        uint64_t    ratios_version;
+        uint64_t    volume_version;
+
+        stock_metrics() : ratios_version(0), volume_version(0)
+        {
+        }
+
+        size_t size() const
+        {
+            return price.size();
+        }
+
+        void resize(size_t n)
+        {
+            price.resize(n);
+            yield_dividend.resize(n);
+            last_dividend.resize(n);
+            yield.resize(n);
+            pe.resize(n);
+            volume.resize(n);
+        }
+
+        const column &field(int f) const
+        {
+            switch(f)
+            {
+                case FIELD_YIELD:       return yield;
+                case FIELD_PE:          return pe;
+                case FIELD_DIVIDEND:    return last_dividend;
+                case FIELD_VOLUME:      return volume;
+                default:                return price;
+            }
+        }
+
+        uint64_t version(int f) const
+        {
+            return (f == FIELD_VOLUME) ? volume_version : ratios_version;
+        }
+
+        void add_volume(size_t i,double q)
+        {
+            volume[i] += q;
+            volume_version++;
+        }
+
+        void clear_volume()
+        {
+            std::fill(volume.begin(),volume.end(),0.0);
+            volume_version++;
+        }
+
+        // Recalculate the ratios of one row
+
+        void update(size_t i)
+        {
+            yield[i] = price[i] ? yield_dividend[i] / price[i] : 0.0;
+            pe[i] = last_dividend[i] ? price[i] / last_dividend[i] : 0.0;
+            ratios_version++;
+        }
+
+        // Recalculate the ratios of all rows
+
+        void evaluate()
+        {
+            size_t n = size(),i = 0;
+            const double *p = price.data(),*yd = yield_dividend.data(),*ld = last_dividend.data();
+            double *y = yield.data(),*r = pe.data();
+
+#if defined(__AVX__)
+            const __m256d zero = _mm256_setzero_pd();
+
+            for(; i + 4 <= n; i += 4)
+            {
+                __m256d vp = _mm256_loadu_pd(p + i);
+                __m256d vl = _mm256_loadu_pd(ld + i);
+                __m256d vy = _mm256_div_pd(_mm256_loadu_pd(yd + i),vp);
+                __m256d vr = _mm256_div_pd(vp,vl);
+
+                _mm256_storeu_pd(y + i,_mm256_and_pd(vy,_mm256_cmp_pd(vp,zero,_CMP_NEQ_OQ)));
+                _mm256_storeu_pd(r + i,_mm256_and_pd(vr,_mm256_cmp_pd(vl,zero,_CMP_NEQ_OQ)));
+            }
+#elif defined(__SSE2__)
+            const __m128d zero = _mm_setzero_pd();
+
+            for(; i + 2 <= n; i += 2)
+            {
+                __m128d vp = _mm_loadu_pd(p + i);
+                __m128d vl = _mm_loadu_pd(ld + i);
+                __m128d vy = _mm_div_pd(_mm_loadu_pd(yd + i),vp);
+                __m128d vr = _mm_div_pd(vp,vl);
+
+                _mm_storeu_pd(y + i,_mm_and_pd(vy,_mm_cmpneq_pd(vp,zero)));
+                _mm_storeu_pd(r + i,_mm_and_pd(vr,_mm_cmpneq_pd(vl,zero)));
+            }
+#endif
+            for(; i < n; i++)
+                update(i);
+
+            ratios_version++;
+        }
+};
+
+/*
+    Standing alerts. Each alert is one or two price thresholds ("legs")
+    filed under its symbol (the empty ticker stands for the index) in
+    two ordered maps, one for rising and one for falling prices. A price
+    change from 'before' to 'after' only looks at the legs between the
+    two, so the cost of an update is a hash lookup, a binary search and
+    the alerts that actually fire, however many are registered.
+*/
+
+enum
+{
+    ALERT_ABOVE = 0,    // Price rises to or above a value
+    ALERT_BELOW,        // Price falls to or below a value
+    ALERT_MOVE,         // Price moves a percentage away from par, either way
+};
+
+const char *alert_names[] = { "above", "below", "move" };
+
+class alert_book
+{
+    private:
+
+        struct alert
+        {
+            ticker      symbol;
+            int         kind;
+            double      value;      // As given
+            double      up;         // Rising leg threshold (NAN if none)
+            double      down;       // Falling leg threshold (NAN if none)
+            uint64_t    fired;
+            bool        active;     // Not dropped
+        };
+
+        struct legs
+        {
+            std::multimap<double,uint32_t> up;
+            std::multimap<double,uint32_t> down;
+        };
+
+        std::vector<alert>                  alerts;     // By id, from 1
+        std::unordered_map<uint64_t,legs>   by_symbol;
+        size_t      count;
+        uint64_t    checks;
+        uint64_t    notified;
+        bool        quiet;          // Count but do not print (benchmarks)
+
+        static void unfile(std::multimap<double,uint32_t> &m,double at,uint32_t id)
+        {
+            std::pair<std::multimap<double,uint32_t>::iterator,
+                      std::multimap<double,uint32_t>::iterator> r = m.equal_range(at);
+
+            for(; r.first != r.second; r.first++)
+            {
+                if(r.first->second == id)
+                {
+                    m.erase(r.first);
+                    return;
+                }
+            }
+        }
+
+        void file(uint32_t id,const alert &a)
+        {
+            legs &l = by_symbol[a.symbol.value()];
+
+            if(a.up == a.up)
+                l.up.insert(std::make_pair(a.up,id));
+            if(a.down == a.down)
+                l.down.insert(std::make_pair(a.down,id));
+        }
+
+        void notify(uint32_t id,alert &a,double price,bool rising)
+        {
+            a.fired++;
+            notified++;
+
+            if(quiet)
+                return;
+
+            std::cout << std::setprecision(4) << std::fixed;
+            std::cout << "ALERT " << id << ": ";
+            if(a.symbol.empty())
+                std::cout << "GBCE Index " << price;
+            else
+                std::cout << a.symbol << " price " << price;
+            std::cout << (rising ? " crossed above " : " crossed below ") << (rising ? a.up : a.down);
+
+            if(a.kind == ALERT_MOVE)
+                std::cout << std::setprecision(2) << " (" << a.value << "% from par)";
+            std::cout << std::endl;
+        }
+
+    public:
+
+        alert_book(bool q = false) : alerts(1), count(0), checks(0), notified(0), quiet(q)
+        {
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        // Register an alert, returns its id (0 if the value is not usable).
+        // 'par' is only used by ALERT_MOVE.
+
+        uint32_t add(ticker symbol,int kind,double value,double par)
+        {
+            alert a;
+
+            if(!std::isfinite(value) || (kind == ALERT_MOVE && value <= 0))
+                return 0;
+
+            a.symbol = symbol;
+            a.kind = kind;
+            a.value = value;
+            a.up = a.down = NAN;
+            a.fired = 0;
+            a.active = true;
+
+            switch(kind)
+            {
+                case ALERT_ABOVE:
+                    a.up = value;
+                    break;
+                case ALERT_BELOW:
+                    a.down = value;
+                    break;
+                default:
+                    a.up = par * (1.0 + value / 100.0);
+                    a.down = par * (1.0 - value / 100.0);
+                    break;
+            }
+
+            alerts.push_back(a);
+            file(alerts.size() - 1,a);
+            count++;
+
+            return alerts.size() - 1;
+        }
+
+        bool drop(uint32_t id)
+        {
+            if(id == 0 || id >= alerts.size() || !alerts[id].active)
+                return false;
+
+            alert &a = alerts[id];
+            legs &l = by_symbol[a.symbol.value()];
+
+            if(a.up == a.up)
+                unfile(l.up,a.up,id);
+            if(a.down == a.down)
+                unfile(l.down,a.down,id);
+
+            a.active = false;
+            count--;
+
+            return true;
+        }
+
+        // A price moved: fire the alerts whose thresholds it crossed
+
+        void check(ticker symbol,double before,double after)
+        {
+            if(!count || !(before != after))
+                return;
+
+            std::unordered_map<uint64_t,legs>::iterator l = by_symbol.find(symbol.value());
+
+            if(l == by_symbol.end())
+                return;
+
+            checks++;
+
+            if(after > before)
+            {
+                std::multimap<double,uint32_t>::iterator a = l->second.up.upper_bound(before);
+
+                for(; a != l->second.up.end() && a->first <= after; a++)
+                    notify(a->second,alerts[a->second],after,true);
+            }
+            else if(after < before)
+            {
+                std::multimap<double,uint32_t>::iterator a = l->second.down.lower_bound(after);
+
+                for(; a != l->second.down.end() && a->first < before; a++)
+                    notify(a->second,alerts[a->second],after,false);
+            }
+        }
+
+        // A split: thresholds of the stock follow its price
+
+        void split(ticker symbol,double ratio)
+        {
+            legs &l = by_symbol[symbol.value()];
+
+            l.up.clear();
+            l.down.clear();
+
+            for(uint32_t id = 1; id < alerts.size(); id++)
+            {
+                alert &a = alerts[id];
+
+                if(!a.active || a.symbol != symbol)
+                    continue;
+
+                a.up /= ratio;
+                a.down /= ratio;
+                if(a.kind != ALERT_MOVE)
+                    a.value /= ratio;
+
+                file(id,a);
+            }
+        }
+
+        uint64_t get_notified() const
+        {
+            return notified;
+        }
+
+        void show() const
+        {
+            std::cout << std::setprecision(4) << std::fixed;
+
+            for(uint32_t id = 1; id < alerts.size(); id++)
+            {
+                const alert &a = alerts[id];
+
+                if(!a.active)
+                    continue;
+
+                std::cout << std::setw(6) << id << " ";
+                if(a.symbol.empty())
+                    std::cout << "index";
+                else
+                    std::cout << a.symbol;
+                std::cout << " " << alert_names[a.kind] << " " << a.value;
+                std::cout << ", fired " << a.fired << " times" << std::endl;
+            }
+
+            std::cout << count << " alerts, " << checks << " price changes checked, ";
+            std::cout << notified << " notifications" << std::endl;
+        }
+};
+
+alert_book alerts;
+
+/*
+    Pricing provenance. When enabled every price update of an stock is
+    recorded as the method and window it used and the range of trade ids
+    inside it,
+    32 bytes per update in a bounded ring per stock, which is enough to
+    find the trades again in trade_db and check the price. When disabled
+    the price path pays one test.
+*/
+
+#define AUDIT_DEPTH     1024            // Updates kept per stock by default
+
+struct price_origin
+{
+    uint32_t    at;             // When the price was set, seconds since the epoch
+    uint32_t    param;          // Window seconds, trades or bucket shares, by method
+    uint64_t    first_id;       // First and last trade_db position in the window
+    uint32_t    span;           // last_id - first_id
+    uint32_t    trades;         // Trades in the window (0: price kept)
+    float       price;
+    uint8_t     method;
+    uint8_t     splits;         // Splits of the stock by then
+};
+
+class provenance
+{
+    private:
+
+        struct history
+        {
+            std::vector<price_origin> ring;
+            size_t      next;           // Total recorded, ring position is next % depth
+        };
+
+        bool        enabled;
+        size_t      depth;
+        std::unordered_map<uint64_t,history> stocks;
+
+    public:
+
+        provenance() : enabled(false), depth(AUDIT_DEPTH)
+        {
+        }
+
+        bool active() const
+        {
+            return enabled;
+        }
+
+        void enable(size_t d)
+        {
+            enabled = true;
+            if(d && d != depth)
+            {
+                depth = d;
+                stocks.clear();
+            }
+        }
+
+        void disable()
+        {
+            enabled = false;
+        }
+
+        // Forget everything recorded, when the trades it points to leave trade_db
+
+        void clear()
+        {
+            stocks.clear();
+        }
+
+        void record(ticker symbol,const price_origin &o)
+        {
+            history &h = stocks[symbol.value()];
+
+            if(h.ring.size() < depth)
+                h.ring.push_back(o);
+            else
+                h.ring[h.next % depth] = o;
+
+            h.next++;
+        }
+
+        // The last n updates of an stock, oldest first
+
+        std::vector<price_origin> last(ticker symbol,size_t n) const
+        {
+            std::vector<price_origin> out;
+            std::unordered_map<uint64_t,history>::const_iterator h = stocks.find(symbol.value());
+
+            if(h == stocks.end())
+                return out;
+
+            n = std::min(n,h->second.ring.size());
+
+            for(size_t i = h->second.next - n; i < h->second.next; i++)
+                out.push_back(h->second.ring[i % h->second.ring.size()]);
+
+            return out;
+        }
+};
+
+provenance audit;
+
+// Page faults taken by the process so far
+
+long page_faults()
+{
+#ifndef _WIN32
+    struct rusage ru;
+
+    if(!getrusage(RUSAGE_SELF,&ru))
+        return ru.ru_minflt + ru.ru_majflt;
+#endif
+    return 0;
+}
+
+/*
+    Engine telemetry for scraping. Counters and histograms are atomics
+    the engine updates as it goes and a reader samples whenever it likes
+    without taking engine_lock. Writers already hold engine_lock (or own
+    the counter), so an update is a relaxed load and store rather than a
+    locked read-modify-write.
+*/
+
+inline void bump(std::atomic<uint64_t> &c,uint64_t n = 1)
+{
+    c.store(c.load(std::memory_order_relaxed) + n,std::memory_order_relaxed);
+}
+
+// Bucket upper bounds, nanoseconds
+
+const uint64_t latency_bounds[] = { 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 };
+
+#define LATENCY_BUCKETS (sizeof(latency_bounds) / sizeof(latency_bounds[0]))
+
+class latency_histogram
+{
+    private:
+
+        std::atomic<uint64_t> bucket[LATENCY_BUCKETS + 1];     // Last one is +Inf
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> count;
+
+    public:
+
+        latency_histogram() : sum(0), count(0)
+        {
+            for(size_t b = 0; b <= LATENCY_BUCKETS; b++)
+                bucket[b] = 0;
+        }
+
+        void observe(uint64_t ns)
+        {
+            size_t b = 0;
+
+            while(b < LATENCY_BUCKETS && ns > latency_bounds[b])
+                b++;
+
+            bump(bucket[b]);
+            bump(sum,ns);
+            bump(count);
+        }
+
+        // In Prometheus text format, seconds and cumulative buckets
+
+        void render(std::ostream &os,const char *name,const char *help) const
+        {
+            uint64_t total = 0;
+
+            os << "# HELP " << name << " " << help << "\n";
+            os << "# TYPE " << name << " histogram\n";
+
+            for(size_t b = 0; b <= LATENCY_BUCKETS; b++)
+            {
+                total += bucket[b].load(std::memory_order_relaxed);
+
+                os << name << "_bucket{le=\"";
+
+                if(b < LATENCY_BUCKETS)
+                    os << latency_bounds[b] / 1e9;
+                else
+                    os << "+Inf";
+
+                os << "\"} " << total << "\n";
+            }
+
+            os << name << "_sum " << sum.load(std::memory_order_relaxed) / 1e9 << "\n";
+            os << name << "_count " << count.load(std::memory_order_relaxed) << "\n";
+        }
+};
+
+class telemetry_board
+{
+    public:
+
+        std::atomic<uint64_t> trades;           // Recorded into trade_db
+        std::atomic<uint64_t> trade_db_size;
+        std::atomic<uint64_t> trade_db_capacity;
+        std::atomic<uint64_t> price_updates;
+        std::atomic<uint64_t> index_bits;       // The index, a double's bits
+        std::atomic<uint64_t> commands;
+        std::atomic<uint64_t> sessions;         // Closed
+        std::atomic<uint64_t> feed_messages;
+        std::atomic<uint64_t> stocks;
+
+        latency_histogram reprice;              // One stock's price update
+        latency_histogram feed_latency;         // Packet receipt to price update
+
+        telemetry_board() : trades(0), trade_db_size(0), trade_db_capacity(0), price_updates(0),
+                            index_bits(0), commands(0), sessions(0), feed_messages(0), stocks(0)
+        {
+        }
+
+        void set_index(double v)
+        {
+            uint64_t bits;
+
+            memcpy(&bits,&v,sizeof(bits));
+            index_bits.store(bits,std::memory_order_relaxed);
+        }
+
+        double get_index() const
+        {
+            uint64_t bits = index_bits.load(std::memory_order_relaxed);
+            double v;
+
+            memcpy(&v,&bits,sizeof(v));
+            return v;
+        }
+};
+
+telemetry_board telemetry;
+
+// One sample in Prometheus text format
+
+void metric(std::ostream &os,const char *name,const char *type,const char *help,double value)
+{
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " " << type << "\n";
+    os << name << " " << value << "\n";
+}
+
+// Counters as whole numbers, however large
+
+void metric(std::ostream &os,const char *name,const char *type,const char *help,uint64_t value)
+{
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " " << type << "\n";
+    os << name << " " << value << "\n";
+}
+
+/*
+    Live tape: running totals per symbol that any number of threads can
+    update and read without a lock. It is an open addressing table of
+    fixed size; a symbol claims its slot with a compare and swap of the
+    key and is never removed, so a lookup is a probe of plain loads and
+    an update is a few atomic adds. Notional is kept in fixed point so
+    it can be added atomically too. Each slot has its own cache line so
+    writers of different symbols do not share one.
+*/
+
+#define TAPE_SLOTS      65536           // Must be a power of two
+#define TAPE_PROBES     64              // Longest probe before giving up
+#define TAPE_SCALE      10000.0         // Notional units per pound
+#define TAPE_CADENCE    64              // Default trades between a writer's merges
+#define TAPE_LIMIT      4.0e18          // Largest notional one trade may add, in units
+
+struct alignas(64) tape_entry
+{
+    std::atomic<uint64_t> key;          // A ticker's code, 0 while free
+    std::atomic<uint64_t> trades;
+    std::atomic<uint64_t> volume;       // Shares
+    std::atomic<int64_t>  notional;     // Pounds * TAPE_SCALE
+    std::atomic<uint64_t> last;         // Last price, a double's bits
+};
+
+class live_tape
+{
+    private:
+
+        void        *memory;
+        tape_entry  *slots;
+        std::atomic<uint64_t> used;
+        std::atomic<uint64_t> overflows;    // Updates dropped, no slot found or too big
+        std::atomic<uint32_t> cadence;      // Trades a writer holds back at most
+        std::atomic<uint64_t> epoch;        // Bumped by readers wanting a merge
+        std::atomic<uint64_t> merges;
+        std::atomic<uint64_t> generation;   // Bumped by clear(), one per session
+
+    public:
+
+        // calloc() of a block this size maps fresh zero pages, so slots
+        // cost nothing until a symbol lands on them (unlike zeroing 4MB
+        // at startup)
+
+        live_tape() : memory(calloc(TAPE_SLOTS + 1,sizeof(tape_entry))), used(0), overflows(0),
+                      cadence(TAPE_CADENCE), epoch(0), merges(0), generation(0)
+        {
+            if(!memory)
+                throw std::bad_alloc();
+
+            slots = (tape_entry *)(((uintptr_t)memory + sizeof(tape_entry) - 1) & ~(uintptr_t)(sizeof(tape_entry) - 1));
+
+            // Start the entries' lifetimes. Default initialization of the
+            // atomics writes nothing, they keep calloc()'s zeros and the
+            // pages stay untouched.
+
+            for(size_t i = 0; i < TAPE_SLOTS; i++)
+                new (&slots[i]) tape_entry;
+        }
+
+        ~live_tape()
+        {
+            free(memory);
+        }
+
+        // The symbol's slot, claiming a free one if 'add'. NULL if the
+        // symbol is not there (or the table is too full to add it).
+
+        tape_entry *lookup(ticker symbol,bool add)
+        {
+            uint64_t key = symbol.value();
+
+            if(!key)
+                return NULL;
+
+            for(uint64_t i = mix64(key),n = 0; n < TAPE_PROBES; i++,n++)
+            {
+                tape_entry &e = slots[i & (TAPE_SLOTS - 1)];
+                uint64_t k = e.key.load(std::memory_order_acquire);
+
+                if(k == key)
+                    return &e;
+
+                if(k)
+                    continue;
+
+                if(!add)
+                    return NULL;
+
+                if(e.key.compare_exchange_strong(k,key,std::memory_order_acq_rel) || k == key)
+                {
+                    if(k != key)
+                        used.fetch_add(1,std::memory_order_relaxed);
+                    return &e;
+                }
+            }
+
+            return NULL;
+        }
+
+        // A trade's notional in tape units, false if it does not fit
+
+        static bool notional_of(uint64_t quantity,double price,int64_t &notional)
+        {
+            double v = quantity * price * TAPE_SCALE;
+
+            if(!std::isfinite(v) || fabs(v) > TAPE_LIMIT)
+                return false;
+
+            notional = (int64_t)llround(v);
+            return true;
+        }
+
+        void update(ticker symbol,uint64_t quantity,double price)
+        {
+            int64_t notional;
+            tape_entry *e = notional_of(quantity,price,notional) ? lookup(symbol,true) : NULL;
+
+            if(!e)
+            {
+                overflows.fetch_add(1,std::memory_order_relaxed);
+                return;
+            }
+
+            add(*e,1,quantity,notional,price);
+        }
+
+        // Add trades to a symbol's totals. If its notional would pass the
+        // int64 range they are refused and counted as dropped instead.
+
+        bool add(tape_entry &e,uint64_t trades,uint64_t quantity,int64_t notional,double price)
+        {
+            uint64_t bits;
+            int64_t current = e.notional.load(std::memory_order_relaxed);
+
+            do {
+                if(notional > 0 ? current > INT64_MAX - notional : current < INT64_MIN - notional)
+                {
+                    overflows.fetch_add(trades,std::memory_order_relaxed);
+                    return false;
+                }
+            } while(!e.notional.compare_exchange_weak(current,current + notional,std::memory_order_relaxed));
+
+            memcpy(&bits,&price,sizeof(bits));
+
+            e.trades.fetch_add(trades,std::memory_order_relaxed);
+            e.volume.fetch_add(quantity,std::memory_order_relaxed);
+            e.last.store(bits,std::memory_order_relaxed);
+
+            return true;
+        }
+
+        // A symbol's totals, false if it has not traded
+
+        bool totals(ticker symbol,uint64_t &trades,uint64_t &volume,double &notional,double &last)
+        {
+            tape_entry *e = lookup(symbol,false);
+
+            if(!e)
+                return false;
+
+            uint64_t bits = e->last.load(std::memory_order_relaxed);
+
+            trades = e->trades.load(std::memory_order_relaxed);
+            volume = e->volume.load(std::memory_order_relaxed);
+            notional = e->notional.load(std::memory_order_relaxed) / TAPE_SCALE;
+            memcpy(&last,&bits,sizeof(last));
+
+            return true;
+        }
+
+        // The symbols on the tape, in slot order
+
+        std::vector<ticker> symbols() const
+        {
+            std::vector<ticker> out;
+
+            for(size_t i = 0; i < TAPE_SLOTS; i++)
+            {
+                uint64_t k = slots[i].key.load(std::memory_order_acquire);
+
+                if(k)
+                    out.push_back(ticker::from_value(k));
+            }
+
+            return out;
+        }
+
+        // Zero the totals, keeping the symbols' slots. Safe with writers
+        // running, whose concurrent trades may or may not survive. Writers
+        // drop what they held back for the session before.
+
+        void clear()
+        {
+            generation.fetch_add(1,std::memory_order_relaxed);
+
+            for(size_t i = 0; i < TAPE_SLOTS; i++)
+            {
+                slots[i].trades.store(0,std::memory_order_relaxed);
+                slots[i].volume.store(0,std::memory_order_relaxed);
+                slots[i].notional.store(0,std::memory_order_relaxed);
+                slots[i].last.store(0,std::memory_order_relaxed);
+            }
+        }
+
+        // How far writers with their own accumulators may lag the tape
+
+        uint32_t get_cadence() const
+        {
+            return cadence.load(std::memory_order_relaxed);
+        }
+
+        void set_cadence(uint32_t n)
+        {
+            cadence.store(n,std::memory_order_relaxed);
+        }
+
+        // Ask writers to merge what they hold back on their next trade
+
+        void request_merge()
+        {
+            epoch.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        uint64_t merge_epoch() const
+        {
+            return epoch.load(std::memory_order_relaxed);
+        }
+
+        void note_merge()
+        {
+            merges.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        uint64_t session() const
+        {
+            return generation.load(std::memory_order_relaxed);
+        }
+
+        uint64_t size() const
+        {
+            return used.load(std::memory_order_relaxed);
+        }
+
+        uint64_t dropped() const
+        {
+            return overflows.load(std::memory_order_relaxed);
+        }
+
+        // One symbol's totals or all of them, false for a symbol not seen
+
+        bool show(const std::string &which)
+        {
+            std::vector<ticker> list;
+
+            if(which.compare("all"))
+            {
+                if(!lookup(ticker(which),false))
+                    return false;
+                list.push_back(ticker(which));
+            }
+            else
+            {
+                list = symbols();
+                std::sort(list.begin(),list.end());
+            }
+
+            std::cout << "symbol     trades      volume      notional     vwap     last" << std::endl;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                uint64_t trades = 0,volume = 0;
+                double notional = 0.0,last = 0.0;
+
+                totals(list[i],trades,volume,notional,last);
+
+                std::cout << std::left << std::setw(8) << list[i] << std::right << std::setw(9) << trades;
+                std::cout << std::setw(12) << volume << std::setprecision(2) << std::fixed << std::setw(14) << notional;
+                std::cout << std::setw(9) << (volume ? notional / volume : 0.0) << std::setw(9) << last << std::endl;
+            }
+
+            std::cout << size() << " symbols on the tape, writers merge every " << get_cadence() << " trades (";
+            std::cout << merges.load(std::memory_order_relaxed) << " merges so far)";
+            if(dropped())
+                std::cout << ", " << dropped() << " trades dropped (table full or notional too big)";
+            std::cout << std::endl;
+
+            return true;
+        }
+};
+
+live_tape tape;
+startup_mark startup_tape("tape");
+
+/*
+    A writer's own running totals for the symbols it trades, added to the
+    tape every 'cadence' trades rather than on each one. A hot symbol then
+    costs its writers an add to memory nobody else touches, and the tape
+    sees it a bounded number of trades late. Writers also merge when a
+    reader asks (on their next trade) and should flush when they run out
+    of work, so an idle writer holds nothing back. Direct mapped by the
+    symbol's hash: a slot goes to the first symbol to trade after a merge,
+    which for a hot symbol is likely to be itself, and the others sharing
+    it write through to the tape until the next merge.
+*/
+
+#define LOCAL_SLOTS     64              // Symbols held per writer, a power of two
+
+class tape_accumulator
+{
+    private:
+
+        struct pending
+        {
+            uint64_t    key;            // The symbol's code, 0 if unused
+            tape_entry  *entry;
+            uint64_t    trades;
+            uint64_t    volume;
+            int64_t     notional;
+            double      last;
+        };
+
+        live_tape   &target;
+        pending     slot[LOCAL_SLOTS];
+        uint32_t    count;              // Trades held back
+        uint64_t    epoch;              // The tape's merge epoch when last merged
+        uint64_t    generation;         // The tape's session what is held belongs to
+
+        // Forget what is held back once the tape has moved to a new session
+
+        bool stale()
+        {
+            uint64_t now = target.session();
+
+            if(now == generation)
+                return false;
+
+            for(size_t i = 0; i < LOCAL_SLOTS; i++)
+            {
+                slot[i].trades = slot[i].volume = 0;
+                slot[i].notional = 0;
+            }
+
+            count = 0;
+            generation = now;
+
+            return true;
+        }
+
+        void merge(pending &p)
+        {
+            if(!p.trades)
+                return;
+
+            target.add(*p.entry,p.trades,p.volume,p.notional,p.last);
+            p.trades = p.volume = 0;
+            p.notional = 0;
+        }
+
+    public:
+
+        tape_accumulator(live_tape &t) : target(t), count(0), epoch(0), generation(t.session())
+        {
+            memset(slot,0,sizeof(slot));
+        }
+
+        ~tape_accumulator()
+        {
+            flush();
+        }
+
+        void update(ticker symbol,uint64_t quantity,double price)
+        {
+            uint32_t every = target.get_cadence();
+            pending &p = slot[mix64(symbol.value()) & (LOCAL_SLOTS - 1)];
+            int64_t notional;
+
+            stale();
+
+            // The tape counts whatever it can't take
+
+            if(every <= 1 || symbol.empty() || !live_tape::notional_of(quantity,price,notional))
+            {
+                target.update(symbol,quantity,price);
+                return;
+            }
+
+            // Only a symbol new to this slot looks at the shared table. The
+            // slot's holder keeps it until merged, others write through.
+
+            if(p.key != symbol.value())
+            {
+                tape_entry *e = target.lookup(symbol,true);
+
+                if(!e || p.trades)
+                {
+                    if(e)
+                        target.add(*e,1,quantity,notional,price);
+                    else
+                        target.update(symbol,quantity,price);
+                    return;
+                }
+
+                p.key = symbol.value();
+                p.entry = e;
+            }
+
+            // Merge early rather than hold more than an int64 can sum
+
+            if(notional > 0 ? p.notional > INT64_MAX - notional : p.notional < INT64_MIN - notional)
+                merge(p);
+
+            p.trades++;
+            p.volume += quantity;
+            p.notional += notional;
+            p.last = price;
+
+            if(++count >= every || target.merge_epoch() != epoch)
+                flush();
+        }
+
+        // Add everything held back to the tape
+
+        void flush()
+        {
+            if(!stale() && count)
+            {
+                for(size_t i = 0; i < LOCAL_SLOTS; i++)
+                    merge(slot[i]);
+
+                target.note_merge();
+            }
+
+            count = 0;
+            epoch = target.merge_epoch();
+        }
+};
+
+thread_local tape_accumulator tape_local(tape);
+
+/*
+    Reference data: the stock universe, loaded from a CSV file with a
+    line per stock
+
+        symbol,type,last dividend,fixed dividend,par value
+
+    type being Common or Preferred, the fixed dividend a percentage ("2"
+    or "2%") and money in pounds. A header line is skipped. The parsed
+    stocks are kept next to the CSV in a binary cache (<file>.cache):
+    a header naming the source's size and modification time, the stocks
+    as fixed size records and a hash table from symbol to record, ready
+    to use where they lie once the file is mapped. A later load maps the
+    cache instead of parsing, unless the source has changed since.
+*/
+
+#define UNIVERSE_MAGIC      0x55535353      // "SSSU"
+#define UNIVERSE_VERSION    1
+
+struct universe_header
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    source_size;
+    int64_t     source_mtime;       // Seconds
+    int64_t     source_mtime_ns;    // And nanoseconds, where the system has them
+    uint32_t    count;              // Stock records
+    uint32_t    slots;              // Hash table entries, a power of two
+    uint64_t    records_at;         // File offsets
+    uint64_t    table_at;
+};
+
+struct universe_record
+{
+    uint64_t    symbol;             // The ticker's code
+    uint32_t    type;               // COMMON_STOCK or PREF_STOCK
+    uint32_t    reserved;
+    double      last_dividend;
+    double      fixed_dividend;
+    double      par_value;
+};
+
+// Hash table slot of a symbol's record: the record's position plus one,
+// or 0 for an empty slot, probed linearly from mix64(symbol).
+
+inline size_t universe_slot(const uint32_t *table,uint32_t slots,uint64_t symbol,const universe_record *records)
+{
+    for(uint64_t i = mix64(symbol); ; i++)
+    {
+        uint32_t at = table[i & (slots - 1)];
+
+        if(!at || records[at - 1].symbol == symbol)
+            return i & (slots - 1);
+    }
+}
+
+class reference_data
+{
+    private:
+
+        char        *base;              // The cache, mapped or read
+        size_t      length;
+        bool        mapped;
+        std::vector<char> copy;         // Where it is read if it cannot be mapped
+        std::string source;
+        bool        from_cache;         // Last load found the cache current
+        uint64_t    load_ns;
+
+        const universe_header &header() const
+        {
+            return *(const universe_header *)base;
+        }
+
+        void release()
+        {
+#ifdef __linux__
+            if(mapped)
+                munmap(base,length);
+#endif
+            copy.clear();
+            base = NULL;
+            length = 0;
+            mapped = false;
+        }
+
+        static bool source_stamp(const std::string &file,universe_header &h)
+        {
+            struct stat st;
+
+            if(stat(file.c_str(),&st) < 0)
+                return false;
+
+            h.source_size = st.st_size;
+            h.source_mtime = st.st_mtime;
+#ifdef __linux__
+            h.source_mtime_ns = st.st_mtim.tv_nsec;
+#else
+            h.source_mtime_ns = 0;
+#endif
+            return true;
+        }
+
+        // Map (or read) a cache, false unless it is whole and was made
+        // from the source as it is now
+
+        bool open_cache(const std::string &file,const universe_header &want)
+        {
+            release();
+
+#ifdef __linux__
+            int fd = open(file.c_str(),O_RDONLY);
+            struct stat st;
+
+            if(fd < 0)
+                return false;
+
+            if(fstat(fd,&st) == 0 && st.st_size >= (off_t)sizeof(universe_header))
+            {
+                void *p = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE | MAP_POPULATE,fd,0);
+
+                if(p != MAP_FAILED)
+                {
+                    base = (char *)p;
+                    length = st.st_size;
+                    mapped = true;
+                }
+            }
+
+            close(fd);
+#else
+            std::ifstream in(file.c_str(),std::ios::binary);
+
+            copy.assign(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+
+            if(copy.size() >= sizeof(universe_header))
+            {
+                base = &copy[0];
+                length = copy.size();
+            }
+#endif
+
+            if(!base)
+                return false;
+
+            const universe_header &h = header();
+
+            if(h.magic != UNIVERSE_MAGIC || h.version != UNIVERSE_VERSION ||
+               h.source_size != want.source_size || h.source_mtime != want.source_mtime ||
+               h.source_mtime_ns != want.source_mtime_ns || !h.slots || (h.slots & (h.slots - 1)) ||
+               h.count >= h.slots || h.records_at > length || h.table_at > length ||
+               h.records_at % alignof(universe_record) || h.table_at % alignof(uint32_t) ||
+               h.records_at + (uint64_t)h.count * sizeof(universe_record) > length ||
+               h.table_at + (uint64_t)h.slots * sizeof(uint32_t) > length)
+            {
+                release();
+                return false;
+            }
+
+            // Lookups trust the table: each slot must name a record or be
+            // empty, and an empty one must end every probe
+
+            const uint32_t *table = (const uint32_t *)(base + h.table_at);
+            bool empty = false;
+
+            for(uint32_t i = 0; i < h.slots; i++)
+            {
+                if(table[i] > h.count)
+                {
+                    release();
+                    return false;
+                }
+
+                empty |= !table[i];
+            }
+
+            if(!empty)
+                release();
+
+            return empty;
+        }
+
+        // A whole field as a finite number, ending in '%' if 'percent'.
+        // An empty field is 0 when 'empty' allows it.
+
+        static bool number(const std::string &f,double &v,bool percent,bool empty)
+        {
+            char *end;
+
+            v = 0.0;
+            if(f.empty() || (percent && !f.compare("%")))
+                return empty;
+
+            v = strtod(f.c_str(),&end);
+
+            if(end == f.c_str() || !std::isfinite(v))
+                return false;
+
+            if(percent && *end == '%')
+                end++;
+
+            return !*end;
+        }
+
+        // Parse the CSV. On error says which line and why.
+
+        static bool parse(const std::string &file,std::vector<universe_record> &out,std::string &error)
+        {
+            std::ifstream in(file.c_str());
+            std::string line;
+            std::map<uint64_t,size_t> seen;
+            size_t n = 0;
+
+            if(!in)
+            {
+                error = "Cannot read " + file;
+                return false;
+            }
+
+            while(getline(in,line))
+            {
+                n++;
+
+                if(!line.empty() && line[line.size() - 1] == '\r')
+                    line.erase(line.size() - 1);
+
+                if(line.empty())
+                    continue;
+
+                std::vector<std::string> f;
+                std::istringstream fields(line);
+                std::string s;
+
+                while(getline(fields,s,','))
+                    f.push_back(s);
+
+                universe_record r;
+
+                memset(&r,0,sizeof(r));
+
+                if(f.size() != 5 || !number(f[2],r.last_dividend,false,false) ||
+                   !number(f[3],r.fixed_dividend,true,true) || !number(f[4],r.par_value,false,false))
+                {
+                    // The first line may be a header
+
+                    if(n == 1 && out.empty())
+                        continue;
+
+                    std::ostringstream e;
+                    e << file << " line " << n << ": expected symbol,type,last dividend,fixed dividend,par value";
+                    error = e.str();
+                    return false;
+                }
+
+                ticker sym(f[0]);
+                char type = f[1].empty() ? 0 : tolower(f[1][0]);
+
+                if(sym.empty() || (type != 'c' && type != 'p') || r.par_value <= 0.0 ||
+                   r.last_dividend < 0.0 || r.fixed_dividend < 0.0)
+                {
+                    std::ostringstream e;
+                    e << file << " line " << n << ": bad stock " << f[0];
+                    error = e.str();
+                    return false;
+                }
+
+                if(!seen.insert(std::make_pair(sym.value(),n)).second)
+                {
+                    std::ostringstream e;
+                    e << file << " line " << n << ": " << f[0] << " already on line " << seen[sym.value()];
+                    error = e.str();
+                    return false;
+                }
+
+                r.symbol = sym.value();
+                r.type = (type == 'p') ? PREF_STOCK : COMMON_STOCK;
+                out.push_back(r);
+            }
+
+            if(out.empty())
+            {
+                error = "No stocks in " + file;
+                return false;
+            }
+
+            return true;
+        }
+
+        // Write the cache for parsed stocks, through a temporary file so
+        // a reader never maps half of one
+
+        static bool write_cache(const std::string &file,universe_header h,const std::vector<universe_record> &records)
+        {
+            uint32_t slots = 1;
+
+            while(slots < 2 * records.size())
+                slots *= 2;
+
+            std::vector<uint32_t> table(slots,0);
+
+            for(size_t i = 0; i < records.size(); i++)
+                table[universe_slot(&table[0],slots,records[i].symbol,&records[0])] = (uint32_t)(i + 1);
+
+            h.magic = UNIVERSE_MAGIC;
+            h.version = UNIVERSE_VERSION;
+            h.count = (uint32_t)records.size();
+            h.slots = slots;
+            h.records_at = sizeof(h);
+            h.table_at = h.records_at + records.size() * sizeof(universe_record);
+
+            std::string tmp = file + ".tmp";
+            std::ofstream out(tmp.c_str(),std::ios::binary | std::ios::trunc);
+
+            out.write((const char *)&h,sizeof(h));
+            out.write((const char *)&records[0],records.size() * sizeof(universe_record));
+            out.write((const char *)&table[0],table.size() * sizeof(uint32_t));
+            out.close();
+
+            if(!out || rename(tmp.c_str(),file.c_str()) != 0)
+            {
+                remove(tmp.c_str());
+                return false;
+            }
+
+            return true;
+        }
+
+    public:
+
+        reference_data() : base(NULL), length(0), mapped(false), from_cache(false), load_ns(0)
+        {
+        }
+
+        ~reference_data()
+        {
+            release();
+        }
+
+        // Load the universe of a CSV file, from its cache if current,
+        // rebuilding the cache if not
+
+        bool load(const std::string &file,std::string &error)
+        {
+            uint64_t start = now_ns();
+            std::string cache = file + ".cache";
+            universe_header want;
+
+            memset(&want,0,sizeof(want));
+
+            if(!source_stamp(file,want))
+            {
+                error = "Cannot read " + file;
+                return false;
+            }
+
+            from_cache = open_cache(cache,want);
+
+            if(!from_cache)
+            {
+                std::vector<universe_record> records;
+
+                if(!parse(file,records,error))
+                    return false;
+
+                if(!write_cache(cache,want,records) || !open_cache(cache,want))
+                {
+                    error = "Cannot write " + cache;
+                    return false;
+                }
+            }
+
+            source = file;
+            load_ns = now_ns() - start;
+
+            return true;
+        }
+
+        bool loaded() const
+        {
+            return base != NULL;
+        }
+
+        size_t count() const
+        {
+            return base ? header().count : 0;
+        }
+
+        const universe_record *records() const
+        {
+            return (const universe_record *)(base + header().records_at);
+        }
+
+        const uint32_t *table() const
+        {
+            return (const uint32_t *)(base + header().table_at);
+        }
+
+        uint32_t slots() const
+        {
+            return header().slots;
+        }
+
+        void show() const
+        {
+            std::cout << count() << " stocks from " << source << (from_cache ? " (cache)" : " (parsed, cache rebuilt)");
+            std::cout << " in " << std::setprecision(2) << std::fixed << load_ns / 1e6 << " ms, ";
+            std::cout << length / 1024 << "KB " << (mapped ? "mapped" : "read") << ", " << slots() << " hash slots" << std::endl;
+        }
+};
+
+// The loaded universe, NULL while the sample one is used. The index
+// looks symbols up in its hash table, so it lives as long as it is used.
+
+std::unique_ptr<reference_data> universe;
+
+// Sample Table (values in pounds instead pennies to use doubles instead integers).
+
+class the_index
+{
+    private:
+        std::vector<stock> list;
+        size_t      reallocations;      // Times trade_db had to grow
+
+        // Sum of the logs of the stock prices, kept up to date as prices
+        // change so the index never needs a pass over all stocks.
+
+        double      log_sum;
+
+        // Prices, dividends and ratios of the stocks as columns
+
+        stock_metrics metrics;
+
+        int         method;             // How stock prices are made, PRICE_xxx
+
+        // Symbol lookup in a loaded universe's hash table, whose record
+        // positions are the stocks' positions in 'list'
+
+        const uint32_t *symbol_table;
+        uint32_t    symbol_slots;
+
+        size_t row(const stock *st) const
+        {
+            return st - &list[0];
+        }
+
+        // Copy the inputs of an stock's ratios to its row
+
+        void load_row(size_t i)
+        {
+            metrics.price[i] = list[i].get_price();
+            metrics.yield_dividend[i] = list[i].get_yield_dividend();
+            metrics.last_dividend[i] = list[i].get_last_dividend();
+        }
+
+        // Record what a price update of an stock made at 'now' was based on
+
+        void record_origin(const stock *st,time_t now)
+        {
+            price_origin o;
+            uint64_t last_id;
+
+            st->method_span(method,o.trades,o.first_id,last_id);
+            o.at = (uint32_t)now;
+            o.method = (uint8_t)method;
+            o.splits = (uint8_t)st->split_count();
+            o.span = (uint32_t)(last_id - o.first_id);
+            o.price = (float)st->get_price();
+
+            switch(method)
+            {
+                case PRICE_VOLUME:  o.param = windows.get_bucket_shares(); break;
+                case PRICE_LAST:    o.param = (uint32_t)windows.get_last_trades(); break;
+                default:            o.param = (uint32_t)windows[windows.get_pricing()]; break;
+            }
+
+            audit.record(st->get_symbol(),o);
+        }
+
+    public:
+
+        the_index() : reallocations(0), log_sum(0.0), method(PRICE_VWAP), symbol_table(NULL), symbol_slots(0)
+        {
+            list.push_back(stock("TEA",COMMON_STOCK,0.00,0, 1.00));
+            list.push_back(stock("POP",COMMON_STOCK,0.08,0, 1.00));
+            list.push_back(stock("ALE",COMMON_STOCK,0.23,0, 0.60));
+            list.push_back(stock("GIN",PREF_STOCK,0.08,2, 1.00));
+            list.push_back(stock("JOE",COMMON_STOCK,0.13,0, 2.50));
+
+            metrics.resize(list.size());
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                log_sum += list[i].contribution();
+                load_row(i);
+            }
+
+            metrics.evaluate();
+            telemetry.set_index(get_index());
+            telemetry.stocks.store(list.size(),std::memory_order_relaxed);
+        }
+
+        const stock_metrics &get_metrics() const
+        {
+            return metrics;
+        }
+
+        // Replace the stocks with a universe's. Only before any trade, as
+        // trades of the old stocks would have nowhere to go.
+
+        bool set_universe(const reference_data &u)
+        {
+            if(!trade_db.empty())
+                return false;
+
+            const universe_record *r = u.records();
+
+            list.clear();
+            list.shrink_to_fit();
+            list.reserve(u.count());
+
+            for(size_t i = 0; i < u.count(); i++)
+                list.push_back(stock(ticker::from_value(r[i].symbol),r[i].type,r[i].last_dividend,r[i].fixed_dividend,r[i].par_value));
+
+            symbol_table = u.table();
+            symbol_slots = u.slots();
+
+            metrics.resize(list.size());
+            log_sum = 0.0;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                log_sum += list[i].contribution();
+                load_row(i);
+            }
+
+            metrics.evaluate();
+            metrics.clear_volume();
+            telemetry.set_index(get_index());
+            telemetry.stocks.store(list.size(),std::memory_order_relaxed);
+
+            return true;
+        }
+
+        ticker symbol_at(size_t i) const
+        {
+            return list[i].get_symbol();
+        }
+
+        // Dividend yield and Price/Earnings Ratio of an stock
+
+        double get_yield(const stock *st) const
+        {
+            return metrics.yield[row(st)];
+        }
+
+        double get_pe(const stock *st) const
+        {
+            return metrics.pe[row(st)];
+        }
+
+        // Find the entry of a symbol (NULL if not in the index)
+
+        stock *find(ticker symbol)
+        {
+            if(symbol_table)
+            {
+                for(uint64_t i = mix64(symbol.value()); ; i++)
+                {
+                    uint32_t at = symbol_table[i & (symbol_slots - 1)];
+
+                    if(!at)
+                        return NULL;
+                    if(list[at - 1].get_symbol() == symbol)
+                        return &list[at - 1];
+                }
+            }
+
+            std::vector<stock>::iterator st = list.begin();
+
+            while (st != list.end())
+            {
+                if(symbol == st->get_symbol())
+                    return &(*st);
+                st++;
+            }
+            return NULL;
+        }
+
+        // Check if a symbol exists in the index
+
+        bool exist(ticker symbol)
+        {
+            return find(symbol) != NULL;
+        }
+
+        // List the symbols of the index
+
+        std::vector<ticker> symbols() const
+        {
+            std::vector<ticker> sy;
+
+            std::vector<stock>::const_iterator st = list.begin();
+
+            while (st != list.end())
+            {
+                sy.push_back(st->get_symbol());
+                st++;
+            }
+            return sy;
+        }
+
+        // Size trade_db for a day of trades and each stock window for
+        // 'window' trades, so none of them reallocates on the trade path.
+
+        void reserve(size_t trades,size_t window)
+        {
+            trade_db.reserve(trades);
+            telemetry.trade_db_capacity.store(trade_db.capacity(),std::memory_order_relaxed);
+
+            std::vector<stock>::iterator st = list.begin();
+
+            while (st != list.end())
+            {
+                st->reserve(window);
+                st++;
+            }
+        }
+
+        // End a session. Every stock closes its bar and empties its
+        // windows, and the session's trades move to 'day', which gives
+        // trade_db its storage (a store archived before, so room for a
+        // day is already there). Costs a pass over the stocks, not over
+        // the trades.
+
+        void end_of_day(int day,trade_store &trades,std::vector<day_bar> &bars)
+        {
+            bars.clear();
+
+            for(size_t i = 0; i < list.size(); i++)
+                bars.push_back(list[i].close_day(day));
+
+            trades.clear();
+            trade_db.swap(trades);
+
+            bump(telemetry.sessions);
+            telemetry.trade_db_size.store(0,std::memory_order_relaxed);
+            telemetry.trade_db_capacity.store(trade_db.capacity(),std::memory_order_relaxed);
+
+            metrics.clear_volume();
+            audit.clear();
+            tape_local.flush();
+            tape.clear();
+        }
+
+        size_t get_reallocations() const
+        {
+            return reallocations;
+        }
+
+        size_t stock_count() const
+        {
+            return list.size();
+        }
+
+        // Store a trade and account it in the window of its stock. A trade
+        // of an unknown stock is not stored, NULL is returned.
+
+        stock *record(const trade_op &op)
+        {
+            stock *st = find(op.symbol);
+
+            if(!st)
+                return NULL;
+
+            if(!telemetry.trades.load(std::memory_order_relaxed))
+                startup.mark("first trade");
+
+            if(trade_db.size() == trade_db.capacity())
+                reallocations++;
+
+            trade_db.push_back(op);
+            tape_local.update(op.symbol,op.quantity,op.price);
+
+            bump(telemetry.trades);
+            telemetry.trade_db_size.store(trade_db.size(),std::memory_order_relaxed);
+            telemetry.trade_db_capacity.store(trade_db.capacity(),std::memory_order_relaxed);
+
+            st->add_trade(op,trade_db.size() - 1);
+            metrics.add_volume(row(st),op.quantity);
+
+            return st;
+        }
+
+        // Reprice an stock from its trading by the index's method,
+        // updating its contribution to the index.
+
+        double reprice(stock *st)
+        {
+            double before = st->contribution();
+            double old_price = st->get_price(),old_index = get_index();
+            uint64_t start = now_ns();
+            time_t now = engine_time.now();
+
+            st->set_price(method,now);
+            log_sum += st->contribution() - before;
+
+            telemetry.reprice.observe(now_ns() - start);
+            bump(telemetry.price_updates);
+            telemetry.set_index(get_index());
+
+            metrics.price[row(st)] = st->get_price();
+            metrics.update(row(st));
+
+            if(audit.active())
+                record_origin(st,now);
+
+            alerts.check(st->get_symbol(),old_price,st->get_price());
+            alerts.check(ticker(),old_index,get_index());
+
+            return st->get_price();
+        }
+
+        // Recompute a recorded price from trade_db by its method, in the
+        // shares of the time. Returns the trades found, 'p' their price.
+
+        uint32_t replay_origin(ticker symbol,const price_origin &o,double &p)
+        {
+            stock *st = find(symbol);
+            std::vector<time_t> stamp;
+            std::vector<double> prices;
+            double value = 0.0,volume = 0.0;
+            bool windowed = (o.method == PRICE_VWAP || o.method == PRICE_TWAP);
+
+            p = 0.0;
+
+            if(!st || !o.trades)
+                return 0;
+
+            for(uint64_t id = o.first_id; id <= o.first_id + o.span && id < trade_db.size(); id++)
+            {
+                const trade_op &op = trade_db[id];
+                double adj = st->adjustment(id,o.splits);
+
+                if(op.symbol != symbol || (windowed && (time_t)o.param < ((time_t)o.at - op.stamp)))
+                    continue;
+
+                stamp.push_back(op.stamp);
+                prices.push_back(op.price / adj);
+                value += op.quantity * op.price;
+                volume += op.quantity * adj;
+            }
+
+            size_t n = stamp.size();
+
+            if(!n)
+                return 0;
+
+            switch(o.method)
+            {
+                case PRICE_TWAP:
+                {
+                    time_t now = std::max((time_t)o.at,stamp[n - 1]);
+                    double area = prices[n - 1] * (now - stamp[n - 1]);
+
+                    for(size_t i = 0; i + 1 < n; i++)
+                        area += prices[i] * (stamp[i + 1] - stamp[i]);
+
+                    p = (now == stamp[0]) ? prices[n - 1] : area / (now - stamp[0]);
+                    break;
+                }
+
+                case PRICE_VOLUME:
+                    if(volume > o.param)
+                        p = (value - (volume - o.param) * prices[0]) / o.param;
+                    else
+                        p = value / volume;
+                    break;
+
+                case PRICE_LAST:
+                    for(size_t i = 0; i < n; i++)
+                        p += prices[i];
+
+                    p /= n;
+                    break;
+
+                default:
+                    p = value / volume;
+                    break;
+            }
+
+            return n;
+        }
+
+        // Corporate actions. Only the stock affected is recalculated.
+
+        bool set_dividend(ticker symbol,double ld,double fd)
+        {
+            stock *st = find(symbol);
+
+            if(!st || !std::isfinite(ld) || !std::isfinite(fd) || ld < 0 || fd < 0)
+                return false;
+
+            st->set_dividend(ld,fd);
+
+            load_row(row(st));
+            metrics.update(row(st));
+
+            return true;
+        }
+
+        bool split(ticker symbol,double ratio)
+        {
+            stock *st = find(symbol);
+
+            if(!st || !std::isfinite(ratio) || ratio <= 0)
+                return false;
+
+            double before = st->contribution(),old_index = get_index();
+
+            st->split(ratio,trade_db.size());
+            log_sum += st->contribution() - before;
+
+            alerts.split(symbol,ratio);
+            alerts.check(ticker(),old_index,get_index());
+            telemetry.set_index(get_index());
+
+            // Today's volume in today's shares
+
+            metrics.add_volume(row(st),metrics.volume[row(st)] * (ratio - 1.0));
+
+            load_row(row(st));
+            metrics.update(row(st));
+
+            return true;
+        }
+
+        // A function to show the index list
+
+        void show()
+        {
+            std::cout << std::setprecision(2) << std::fixed;
+
+            std::cout << "=== ==== ======== ==== ======== ========" << std::endl;
+            std::cout << "Sym Type Last Div Fix  PAR Val. T. Price" << std::endl;
+            std::cout << "=== ==== ======== ==== ======== ========" << std::endl;
+
+            std::vector<stock>::const_iterator st = list.begin();
+
+            while (st != list.end())
+            {
+                st->show();
+                st++;
+            }
+        }
+
+        // A function to trade stock
+
+        bool trade(ticker symbol,int op,int num,double price,ticker account = ticker())
+        {
+            /* Check if parameters correct */
+
+            if(symbol.empty() || !std::isfinite(price) || price < 0 || num < 0)
+                return false;
+
+            return record(trade_op(symbol,op,num,price,account)) != NULL;
+        }
+
+        // A random trading operation
+
+        void random_trade(const char *sym)
+        {
+            ticker symbol(sym);
+
+            record(
+                trade_op(
+                    symbol,
+                    (engine_rng.next() & 1) ? BUY_STOCK : SELL_STOCK,
+                    1 + engine_rng.below(109),
+                    0.41 + ((double)engine_rng.below(299) / 100.0),
+                    random_account()
+                )
+            );
+        }
+
+        // Calculate the index: the geometric mean of the prices, as the
+        // exponential of the mean of their logs.
+
+        double get_index(void)
+        {
+            /* ignore 0 values from input but take them into account
+               in the n-root calculation. This throws the same result
+               than changing zeros to ones before each multiplication,
+               but its a lot faster. ;-)
+            */
+            return exp(log_sum / (double) list.size());
+        }
+
+
+        void dividend_yield()
+        {
+            std::cout << std::setprecision(2) << std::fixed;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                std::cout << "Dividend Yield of " << list[i].get_symbol();
+                std::cout << " is " << metrics.yield[i] << std::endl;
+            }
+        }
+
+        void pe_ratio()
+        {
+            std::cout << std::setprecision(2) << std::fixed;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                std::cout << "Price/Earnings Ratio of " << list[i].get_symbol();
+                std::cout << " is " << metrics.pe[i] << std::endl;
+            }
+        }
+
+        // Reprice all stocks, then their ratios in one pass
+
+        void price()
+        {
+            double old_index = get_index();
+            time_t now = engine_time.now();
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                double before = list[i].contribution(),old_price = list[i].get_price();
+                uint64_t start = now_ns();
+
+                list[i].set_price(method,now);
+                log_sum += list[i].contribution() - before;
+
+                telemetry.reprice.observe(now_ns() - start);
+                bump(telemetry.price_updates);
+                metrics.price[i] = list[i].get_price();
+
+                if(audit.active())
+                    record_origin(&list[i],now);
+
+                alerts.check(list[i].get_symbol(),old_price,list[i].get_price());
+            }
+
+            alerts.check(ticker(),old_index,get_index());
+            telemetry.set_index(get_index());
+
+            metrics.evaluate();
+
+            std::cout << std::setprecision(2) << std::fixed;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                std::cout << "Price of " << list[i].get_symbol();
+                std::cout << " is " << list[i].get_price() << std::endl;
+            }
+        }
+
+        // Prices over another window than the pricing one, without
+        // changing them. Windows kept are read from their sums, other
+        // lengths scan the trades in the longest window.
+
+        void price(time_t interval)
+        {
+            time_t now = engine_time.now();
+            int w = windows.find(interval);
+
+            std::cout << std::setprecision(2) << std::fixed;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                double vwap = 0.0;
+                bool traded;
+
+                if(w >= 0)
+                {
+                    list[i].expire(now);
+                    traded = list[i].window_price(w,vwap);
+                }
+                else
+                    traded = list[i].window_price(interval,now,vwap);
+
+                std::cout << "Price of " << list[i].get_symbol() << " over " << window_config::name(interval);
+
+                if(traded)
+                    std::cout << " is " << vwap << std::endl;
+                else
+                    std::cout << " has no trades" << std::endl;
+            }
+        }
+
+        // Every method side by side over the pricing window
+
+        void compare()
+        {
+            time_t now = engine_time.now();
+            size_t w = windows.get_pricing();
+
+            std::cout << std::setprecision(2) << std::fixed;
+            std::cout << "Stock ";
+
+            for(int m = 0; m < PRICE_METHODS; m++)
+                std::cout << std::setw(10) << method_names[m] << (m == method ? "*" : " ");
+
+            std::cout << std::endl;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                list[i].expire(now);
+
+                std::cout << std::setw(5) << list[i].get_symbol() << " ";
+
+                for(int m = 0; m < PRICE_METHODS; m++)
+                {
+                    double p;
+
+                    if(list[i].method_price(m,w,now,p))
+                        std::cout << std::setw(10) << p << " ";
+                    else
+                        std::cout << std::setw(10) << "-" << " ";
+                }
+
+                std::cout << std::endl;
+            }
+
+            std::cout << "(" << window_config::name(windows[w]) << " window, " << windows.get_bucket_shares();
+            std::cout << " share bucket, last " << windows.get_last_trades() << " trades, * prices the index)" << std::endl;
+        }
+
+        int get_method() const
+        {
+            return method;
+        }
+
+        // Price by another method from the next update. The volume and
+        // last trades methods can also change their bucket or count,
+        // which restarts their sums.
+
+        bool set_method(int m,long param = 0)
+        {
+            if(m < 0 || m >= PRICE_METHODS)
+                return false;
+
+            if(param && m == PRICE_VOLUME && !windows.set_bucket_shares(param))
+                return false;
+
+            if(param && m == PRICE_LAST && (param < 0 || !windows.set_last_trades(param)))
+                return false;
+
+            if(param && (m == PRICE_VOLUME || m == PRICE_LAST))
+            {
+                for(size_t i = 0; i < list.size(); i++)
+                    list[i].reset_windows();
+            }
+
+            method = m;
+            return true;
+        }
+
+        // Today's volume at price of an stock: point of control, value
+        // area (the middle 70% of the volume) and the 'n' busiest levels
+
+        bool show_profile(ticker symbol,size_t n)
+        {
+            stock *st = find(symbol);
+
+            if(!st)
+                return false;
+
+            const volume_profile &vp = st->get_profile();
+
+            std::cout << std::setprecision(2) << std::fixed;
+            std::cout << symbol << " volume profile, tick " << vp.get_tick() << ", " << vp.volume() << " shares";
+
+            if(vp.volume() <= 0)
+            {
+                std::cout << ", no trades today" << std::endl;
+                return true;
+            }
+
+            std::cout << " over " << vp.range() << " levels" << std::endl;
+
+            size_t poc = vp.point_of_control();
+            double q[] = { 0.05, 0.25, 0.5, 0.75, 0.95 };
+
+            std::cout << "POC " << vp.price_of(poc) << " (" << vp.at(poc) << " shares), value area ";
+            std::cout << vp.price_of(vp.percentile(0.15)) << " - " << vp.price_of(vp.percentile(0.85)) << std::endl;
+
+            for(size_t i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+                std::cout << (i ? "  " : "") << "p" << (int)(q[i] * 100) << " " << vp.price_of(vp.percentile(q[i]));
+
+            std::cout << std::endl;
+
+            // Busiest levels, highest price first
+
+            std::vector<std::pair<double,size_t> > busy;
+
+            for(size_t i = 0; i < vp.range(); i++)
+                if(vp.at(i) > 0)
+                    busy.push_back(std::make_pair(-vp.at(i),i));
+
+            n = std::min(n,busy.size());
+            std::partial_sort(busy.begin(),busy.begin() + n,busy.end());
+
+            std::vector<size_t> shown;
+
+            for(size_t i = 0; i < n; i++)
+                shown.push_back(busy[i].second);
+
+            std::sort(shown.rbegin(),shown.rend());
+
+            for(size_t i = 0; i < shown.size(); i++)
+            {
+                size_t l = shown[i];
+
+                std::cout << std::setw(12) << vp.price_of(l) << std::setw(12) << vp.at(l) << " ";
+                std::cout << std::string((size_t)(40 * vp.at(l) / vp.at(poc) + 0.5),'#') << std::endl;
+            }
+
+            return true;
+        }
+
+        // The sketches of an stock, or of all stocks merged: today's and
+        // the current and last tumbling windows'
+
+        bool merged_sketches(const std::string &which,time_t now,trade_sketches merged[3])
+        {
+            bool found = false;
+
+            for(size_t i = 0; i < list.size(); i++)
+            {
+                if(which.compare("all") && list[i].get_symbol() != ticker(which))
+                    continue;
+
+                const trade_sketches *current,*last;
+
+                list[i].window_sketches(now,current,last);
+
+                merged[0].merge(list[i].get_day_sketches());
+                merged[1].merge(*current);
+                merged[2].merge(*last);
+                found = true;
+            }
+
+            return found;
+        }
+
+        // Trade size and price quantiles of an stock, or of all stocks
+
+        bool show_quantiles(const std::string &which)
+        {
+            std::string len = window_config::name(windows[windows.get_pricing()]);
+            trade_sketches merged[3];
+            const char *rows[3] = { "today", "this", "last" };
+            double q[3] = { 0.5, 0.95, 0.99 };
+
+            if(!merged_sketches(which,engine_time.now(),merged))
+                return false;
+
+            std::cout << std::setprecision(2) << std::fixed;
+            std::cout << which << std::setw(18 - which.size()) << "trades" << "    size p50     p95     p99";
+            std::cout << "   price p50     p95     p99" << std::endl;
+
+            for(int r = 0; r < 3; r++)
+            {
+                std::string label = r ? std::string(rows[r]) + " " + len : rows[r];
+
+                std::cout << "  " << label << std::setw(16 - label.size()) << merged[r].size.count();
+
+                for(int k = 0; k < 3; k++)
+                    std::cout << std::setw(k ? 8 : 12) << merged[r].size.quantile(q[k]);
+
+                for(int k = 0; k < 3; k++)
+                    std::cout << std::setw(k ? 8 : 12) << merged[r].price.quantile(q[k]);
+
+                std::cout << std::endl;
+            }
+
+            return true;
+        }
+
+        // Distinct accounts trading an stock (or all stocks) and the 'n'
+        // with the most volume today
+
+        bool show_accounts(const std::string &which,size_t n)
+        {
+            std::string len = window_config::name(windows[windows.get_pricing()]);
+            trade_sketches merged[3];
+
+            if(!merged_sketches(which,engine_time.now(),merged))
+                return false;
+
+            std::cout << std::setprecision(0) << std::fixed;
+            std::cout << which << ": about " << merged[0].accounts.estimate() << " accounts today, ";
+            std::cout << merged[1].accounts.estimate() << " this " << len << ", ";
+            std::cout << merged[2].accounts.estimate() << " last " << len << std::endl;
+
+            std::vector<heavy_hitters::counter> top = merged[0].leaders.top(n);
+
+            for(size_t i = 0; i < top.size(); i++)
+            {
+                std::cout << std::setw(10) << top[i].key << std::setw(12) << top[i].count << " shares";
+
+                if(top[i].error > 0)
+                    std::cout << " (at least " << top[i].count - top[i].error << ")";
+
+                std::cout << std::endl;
+            }
+
+            return true;
+        }
+
+        void set_profile_tick(double t)
+        {
+            profile_tick = t;
+
+            for(size_t i = 0; i < list.size(); i++)
+                list[i].set_profile_tick(t);
+        }
+
+        // Change the windows kept by every stock
+
+        bool set_windows(const std::vector<time_t> &secs,time_t pricing)
+        {
+            if(!windows.set(secs,pricing))
+                return false;
+
+            for(size_t i = 0; i < list.size(); i++)
+                list[i].reset_windows();
+
+            return true;
+        }
+
+        // Show all trading operations
+
+        void list_trade()
+        {
+            struct tm *td;
+
+            trade_store::const_iterator op = trade_db.begin();
+
+            std::cout << std::setprecision(2) << std::fixed;
+
+            while (op != trade_db.end())
+            {
+                td = localtime(&(op->stamp));
+
+                std::cout << "[" << std::setw(4) << (td->tm_year % 256) + 1900;
+                std::cout << "-" << std::setw(2) << td->tm_mon+1;
+                std::cout << "-" << std::setw(2) << td->tm_mday;
+                std::cout << " " << std::setw(2) << td->tm_hour;
+                std::cout << ":" << std::setw(2) << td->tm_min;
+                std::cout << ":" << std::setw(2) << td->tm_sec;
+                std::cout << "] " << (op->operation == BUY_STOCK ? "BOUGHT":"SOLD");
+
+                // Trades before a split are shown in today's shares
+
+                stock *st = find(op->symbol);
+                double adj = st ? st->adjustment(op - trade_db.begin()) : 1.0;
+
+                if(adj == 1.0)
+                    std::cout << " " << op->quantity << " shares of " << op->symbol;
+                else
+                    std::cout << " " << op->quantity * adj << " shares of " << op->symbol;
+
+                std::cout << " at " << op->price / adj;
+
+                if(!op->account.empty())
+                    std::cout << " for " << op->account;
+
+                std::cout << (adj == 1.0 ? "" : " (split adjusted)") << std::endl;
+
+                op++;
+            }
+
+            std::cout << std::endl << trade_db.size() << " trading operations in the database" << std::endl ;
+        }
+
+};
+
+/* The GBCE index */
+
+the_index gbce;
+startup_mark startup_index("index");
+
+/*
+    Stock screener. A screen is a list of predicates like yield>0.05 over
+    the metric columns. Each predicate is evaluated 64 stocks at a time
+    into a bitmap with SIMD compares and the bitmaps are ANDed. A sorted
+    index can be kept on a column: when a predicate on it is selective
+    the index range gives the candidates by binary search and only those
+    are checked against the other predicates. Indexes are rebuilt when
+    used after their column changed.
+*/
+
+enum
+{
+    OP_LT = 0,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+};
+
+struct predicate
+{
+    int         field;
+    int         op;
+    double      value;
+};
+
+template <int OP> static inline bool test(double x,double v)
+{
+    switch(OP)
+    {
+        case OP_LT: return x < v;
+        case OP_LE: return x <= v;
+        case OP_GT: return x > v;
+        case OP_GE: return x >= v;
+        default:    return x == v;
+    }
+}
+
+#if defined(__SSE2__)
+template <int OP> static inline __m128d compare(__m128d x,__m128d v)
+{
+    switch(OP)
+    {
+        case OP_LT: return _mm_cmplt_pd(x,v);
+        case OP_LE: return _mm_cmple_pd(x,v);
+        case OP_GT: return _mm_cmpgt_pd(x,v);
+        case OP_GE: return _mm_cmpge_pd(x,v);
+        default:    return _mm_cmpeq_pd(x,v);
+    }
+}
+#endif
+
+// Clear the bits of the rows where c[row] OP v does not hold
+
+template <int OP> static void filter(const stock_metrics::column &c,double v,std::vector<uint64_t> &bits)
+{
+    size_t n = c.size(),i = 0;
+    const double *p = c.data();
+
+#if defined(__SSE2__)
+    const __m128d vv = _mm_set1_pd(v);
+
+    for(; i + 64 <= n; i += 64)
+    {
+        uint64_t word = 0;
+
+        // Eight rows per byte of the bitmap, independent of each other
+
+        for(int j = 0; j < 64; j += 8)
+        {
+            int b = _mm_movemask_pd(compare<OP>(_mm_loadu_pd(p + i + j),vv)) |
+                    _mm_movemask_pd(compare<OP>(_mm_loadu_pd(p + i + j + 2),vv)) << 2 |
+                    _mm_movemask_pd(compare<OP>(_mm_loadu_pd(p + i + j + 4),vv)) << 4 |
+                    _mm_movemask_pd(compare<OP>(_mm_loadu_pd(p + i + j + 6),vv)) << 6;
+
+            word |= (uint64_t)b << j;
+        }
+
+        bits[i / 64] &= word;
+    }
+#endif
+    for(; i < n; i++)
+        if(!test<OP>(p[i],v))
+            bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+class screener
+{
+    private:
+
+        struct sorted_index
+        {
+            bool        enabled;
+            bool        built;
+            uint64_t    version;            // Of the column when built
+            std::vector<std::pair<double,uint32_t> > entries;   // Value and row, by value
+        };
+
+        sorted_index indexes[FIELDS];
+
+        static bool by_value(const std::pair<double,uint32_t> &a,const std::pair<double,uint32_t> &b)
+        {
+            return a.first < b.first;
+        }
+
+        static bool check(const stock_metrics &m,const predicate &p,size_t row)
+        {
+            double x = m.field(p.field)[row];
+
+            switch(p.op)
+            {
+                case OP_LT: return test<OP_LT>(x,p.value);
+                case OP_LE: return test<OP_LE>(x,p.value);
+                case OP_GT: return test<OP_GT>(x,p.value);
+                case OP_GE: return test<OP_GE>(x,p.value);
+                default:    return test<OP_EQ>(x,p.value);
+            }
+        }
+
+        // Bring an index up to date with its column
+
+        void refresh(const stock_metrics &m,int f)
+        {
+            sorted_index &ix = indexes[f];
+
+            if(ix.built && ix.version == m.version(f))
+                return;
+
+            const stock_metrics::column &c = m.field(f);
+
+            ix.entries.clear();
+
+            for(size_t i = 0; i < c.size(); i++)
+                if(c[i] == c[i])                    // NaN never matches, leave it out
+                    ix.entries.push_back(std::make_pair(c[i],(uint32_t)i));
+
+            std::sort(ix.entries.begin(),ix.entries.end(),by_value);
+            ix.version = m.version(f);
+            ix.built = true;
+        }
+
+        // The range of an index matching a predicate
+
+        void range(const predicate &p,size_t &from,size_t &to) const
+        {
+            const std::vector<std::pair<double,uint32_t> > &e = indexes[p.field].entries;
+            std::pair<double,uint32_t> key(p.value,0);
+            size_t lo = std::lower_bound(e.begin(),e.end(),key,by_value) - e.begin();
+            size_t hi = std::upper_bound(e.begin(),e.end(),key,by_value) - e.begin();
+
+            switch(p.op)
+            {
+                case OP_LT: from = 0;  to = lo; break;
+                case OP_LE: from = 0;  to = hi; break;
+                case OP_GT: from = hi; to = e.size(); break;
+                case OP_GE: from = lo; to = e.size(); break;
+                default:    from = lo; to = hi; break;
+            }
+        }
+
+    public:
+
+        screener()
+        {
+            for(int f = 0; f < FIELDS; f++)
+            {
+                indexes[f].enabled = false;
+                indexes[f].built = false;
+                indexes[f].version = 0;
+            }
+        }
+
+        static int field(const std::string &name)
+        {
+            for(int f = 0; f < FIELDS; f++)
+                if(!name.compare(field_names[f]))
+                    return f;
+            return -1;
+        }
+
+        // Parse "yield>0.05" and the like
+
+        static bool parse(const std::string &s,predicate &p)
+        {
+            size_t at = s.find_first_of("<>=");
+
+            if(at == std::string::npos || at == 0 || (p.field = field(s.substr(0,at))) < 0)
+                return false;
+
+            size_t len = (at + 1 < s.size() && s[at + 1] == '=') ? 2 : 1;
+            std::string op = s.substr(at,len);
+
+            if(!op.compare("<"))        p.op = OP_LT;
+            else if(!op.compare("<="))  p.op = OP_LE;
+            else if(!op.compare(">"))   p.op = OP_GT;
+            else if(!op.compare(">="))  p.op = OP_GE;
+            else if(!op.compare("=") || !op.compare("=="))  p.op = OP_EQ;
+            else
+                return false;
+
+            return parse_number(s.substr(at + len),p.value);
+        }
+
+        void set_index(int f,bool on)
+        {
+            indexes[f].enabled = on;
+            indexes[f].built = false;
+            indexes[f].version = 0;
+            indexes[f].entries.clear();
+        }
+
+        bool has_index(int f) const
+        {
+            return indexes[f].enabled;
+        }
+
+        // Rows of the stocks matching all predicates, in index order.
+        // Returns true if an index was used.
+
+        bool screen(const stock_metrics &m,const std::vector<predicate> &preds,std::vector<uint32_t> &out)
+        {
+            size_t n = m.size(),best = preds.size(),best_from = 0,best_to = n;
+
+            out.clear();
+
+            // The most selective predicate with an index
+
+            for(size_t i = 0; i < preds.size(); i++)
+            {
+                if(!indexes[preds[i].field].enabled)
+                    continue;
+
+                size_t from,to;
+
+                refresh(m,preds[i].field);
+                range(preds[i],from,to);
+
+                if(to - from < best_to - best_from)
+                {
+                    best = i;
+                    best_from = from;
+                    best_to = to;
+                }
+            }
+
+            // Worth it when it leaves out most stocks
+
+            if(best < preds.size() && (best_to - best_from) * 8 < n)
+            {
+                const std::vector<std::pair<double,uint32_t> > &e = indexes[preds[best].field].entries;
+
+                for(size_t k = best_from; k < best_to; k++)
+                {
+                    size_t i = 0,row = e[k].second;
+
+                    while(i < preds.size() && (i == best || check(m,preds[i],row)))
+                        i++;
+
+                    if(i == preds.size())
+                        out.push_back(row);
+                }
+
+                std::sort(out.begin(),out.end());
+
+                return true;
+            }
+
+            // Full scan
+
+            std::vector<uint64_t> bits((n + 63) / 64,~(uint64_t)0);
+
+            for(size_t i = 0; i < preds.size(); i++)
+            {
+                const stock_metrics::column &c = m.field(preds[i].field);
+
+                switch(preds[i].op)
+                {
+                    case OP_LT: filter<OP_LT>(c,preds[i].value,bits); break;
+                    case OP_LE: filter<OP_LE>(c,preds[i].value,bits); break;
+                    case OP_GT: filter<OP_GT>(c,preds[i].value,bits); break;
+                    case OP_GE: filter<OP_GE>(c,preds[i].value,bits); break;
+                    default:    filter<OP_EQ>(c,preds[i].value,bits); break;
+                }
+            }
+
+            for(size_t w = 0; w < bits.size(); w++)
+            {
+                for(uint64_t b = bits[w]; b; b &= b - 1)
+                {
+                    size_t row = w * 64 + lowest_bit(b);
+
+                    if(row < n)
+                        out.push_back(row);
+                }
+            }
+
+            return false;
+        }
+};
+
+screener screens;
+
+/*
+    Thread topology. Every thread the engine starts belongs to a role and
+    announces itself on start, which pins it to the CPUs configured for
+    its role (if any). Changing a role's CPUs re-pins its live threads,
+    so the layout can be given at startup or adjusted while running.
+*/
+
+enum
+{
+    ROLE_COMMAND = 0,   // The command line
+    ROLE_INGESTION,     // Applies trades to the index
+    ROLE_PRICING,       // Pricing shards
+    ROLE_NETWORK,       // Network I/O
+    ROLE_PERSISTENCE,   // Journals and archives
+    ROLE_ANALYTICS,     // Background analytics
+    ROLES
+};
+
+const char *role_names[ROLES] = { "command", "ingestion", "pricing", "network", "persistence", "analytics" };
+
+class thread_topology
+{
+    private:
+
+        struct member
+        {
+            std::string name;
+            int         role;
+            long        tid;
+            bool        pinned;
+        };
+
+        std::mutex          lock;
+        std::vector<int>    cpus[ROLES];
+        std::vector<member> threads;
+
+        static long current_tid()
+        {
+#ifdef __linux__
+            return syscall(SYS_gettid);
+#else
+            return 0;
+#endif
+        }
+
+        // Pin a thread to the CPUs of its role, true if done
+
+        bool pin(long tid,int role)
+        {
+#ifdef __linux__
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+
+            if(cpus[role].empty())
+            {
+                // Unpinned roles may run anywhere
+
+                for(int c = 0; c < CPU_SETSIZE && c < cpu_count(); c++)
+                    CPU_SET(c,&set);
+            }
+            else
+            {
+                for(size_t i = 0; i < cpus[role].size(); i++)
+                    CPU_SET(cpus[role][i],&set);
+            }
+
+            return !sched_setaffinity((pid_t)tid,sizeof(set),&set) && !cpus[role].empty();
+#else
+            return false;
+#endif
+        }
+
+    public:
+
+        static int cpu_count()
+        {
+#ifdef __linux__
+            return (int)sysconf(_SC_NPROCESSORS_CONF);
+#else
+            return (int)std::thread::hardware_concurrency();
+#endif
+        }
+
+        static int role(const std::string &name)
+        {
+            for(int r = 0; r < ROLES; r++)
+                if(!name.compare(role_names[r]))
+                    return r;
+            return -1;
+        }
+
+        // Set the CPUs of a role from a list like "2,4-6" ("any" to unpin)
+
+        bool set(int r,const std::string &list)
+        {
+            std::vector<int> tmp;
+
+            if(list.compare("any"))
+            {
+                std::istringstream f(list);
+                std::string s;
+
+                while (getline(f, s, ','))
+                {
+                    int lo,hi;
+                    char dash;
+                    std::istringstream g(s);
+
+                    if(!(g >> lo))
+                        return false;
+                    hi = lo;
+                    if(g >> dash && (dash != '-' || !(g >> hi)))
+                        return false;
+                    if(lo < 0 || hi < lo || hi >= cpu_count())
+                        return false;
+
+                    for(int c = lo; c <= hi; c++)
+                        tmp.push_back(c);
+                }
+
+                if(tmp.empty())
+                    return false;
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            cpus[r] = tmp;
+
+            for(size_t i = 0; i < threads.size(); i++)
+                if(threads[i].role == r)
+                    threads[i].pinned = pin(threads[i].tid,r);
+
+            return true;
+        }
+
+        // Called by a thread when it starts running for a role
+
+        void join(int r,const char *name)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            member m;
+
+            m.name = name;
+            m.role = r;
+            m.tid = current_tid();
+            m.pinned = pin(m.tid,r);
+
+            threads.push_back(m);
+        }
+
+        // Called by a thread before it ends
+
+        void leave()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            long tid = current_tid();
+
+            for(size_t i = 0; i < threads.size(); i++)
+            {
+                if(threads[i].tid == tid)
+                {
+                    threads.erase(threads.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        void show()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            std::cout << "Threads (" << cpu_count() << " CPUs)" << std::endl;
+
+            for(int r = 0; r < ROLES; r++)
+            {
+                std::cout << "    " << std::left << std::setw(12) << role_names[r] << std::right;
+
+                if(cpus[r].empty())
+                    std::cout << "any CPU";
+                else
+                {
+                    std::cout << "CPU";
+                    for(size_t i = 0; i < cpus[r].size(); i++)
+                        std::cout << (i ? "," : " ") << cpus[r][i];
+                }
+
+                int live = 0;
+                for(size_t i = 0; i < threads.size(); i++)
+                {
+                    if(threads[i].role != r)
+                        continue;
+                    std::cout << (live++ ? ", " : " : ") << threads[i].name << " (" << threads[i].tid;
+                    std::cout << (threads[i].pinned ? " pinned)" : ")");
+                }
+                std::cout << std::endl;
+            }
+
+            // Latency critical roles should not share CPUs with background work
+
+            int critical[] = { ROLE_INGESTION, ROLE_NETWORK, ROLE_PRICING };
+            int noisy[] = { ROLE_COMMAND, ROLE_PERSISTENCE, ROLE_ANALYTICS };
+
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 3; j++)
+                    for(size_t a = 0; a < cpus[critical[i]].size(); a++)
+                        if(std::find(cpus[noisy[j]].begin(),cpus[noisy[j]].end(),cpus[critical[i]][a]) != cpus[noisy[j]].end())
+                            std::cout << "    WARNING: " << role_names[critical[i]] << " shares CPU " << cpus[critical[i]][a]
+                                      << " with " << role_names[noisy[j]] << std::endl;
+        }
+};
+
+thread_topology topology;
+
+/*
+    Trading sessions. Once hours are set the engine knows when the market
+    is open, and the first time it notices a close has passed (on any
+    command or feed batch) it ends the session: every stock closes its
+    bar and empties its windows, and the day's trades leave trade_db by a
+    swap. That much is a pass over the stocks under the engine lock; the
+    trades are written to cold storage by the persistence thread, which
+    then hands their store back (or keeps it for a later day) so trade_db
+    does not grow back from nothing.
+
+    Without hours the market never closes, as before.
+*/
+
+#define SESSION_OPEN    (8 * 3600)
+#define SESSION_CLOSE   (16 * 3600 + 30 * 60)
+
+// Thread safe localtime()
+
+inline void local_time(time_t t,struct tm &tm)
+{
+#ifdef _WIN32
+    localtime_s(&tm,&t);
+#else
+    localtime_r(&t,&tm);
+#endif
+}
+
+class session_calendar
+{
+    private:
+
+        bool        enabled;
+        int         open_at;                // Seconds after local midnight
+        int         close_at;
+        std::vector<int> holidays;          // YYYYMMDD, sorted
+        time_t      next_close;
+        uint64_t    refused;                // Trades turned away while closed
+
+        bool trading_day(time_t t) const
+        {
+            struct tm tm;
+
+            local_time(t,tm);
+
+            return tm.tm_wday != 0 && tm.tm_wday != 6 &&
+                   !std::binary_search(holidays.begin(),holidays.end(),day_of(t));
+        }
+
+        // The first close after t, 0 if none within a year
+
+        time_t close_after(time_t t) const
+        {
+            struct tm tm;
+
+            local_time(t,tm);
+
+            for(int d = 0; d < 370; d++)
+            {
+                struct tm c = tm;
+
+                // Noon tells the day, the close may be at midnight
+
+                c.tm_mday += d;
+                c.tm_hour = 12;
+                c.tm_min = c.tm_sec = 0;
+                c.tm_isdst = -1;
+
+                if(!trading_day(mktime(&c)))
+                    continue;
+
+                c.tm_hour = close_at / 3600;
+                c.tm_min = close_at / 60 % 60;
+                c.tm_sec = close_at % 60;
+                c.tm_isdst = -1;
+
+                time_t when = mktime(&c);
+
+                if(when > t)
+                    return when;
+            }
+
+            return 0;
+        }
+
+    public:
+
+        session_calendar() : enabled(false), open_at(SESSION_OPEN), close_at(SESSION_CLOSE), next_close(0), refused(0)
+        {
+        }
+
+        static int day_of(time_t t)
+        {
+            struct tm tm;
+
+            local_time(t,tm);
+
+            return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+        }
+
+        // "16:30" to seconds after midnight, -1 if not a time
+
+        static int parse_time(const std::string &text)
+        {
+            int h,m;
+            char end;
+
+            if(sscanf(text.c_str(),"%d:%d%c",&h,&m,&end) != 2 || h < 0 || h > 24 || m < 0 || m > 59)
+                return -1;
+
+            return h * 3600 + m * 60;
+        }
+
+        // "2026-12-25" to 20261225, 0 if not a date
+
+        static int parse_day(const std::string &text)
+        {
+            int y,m,d;
+            char end;
+
+            if(sscanf(text.c_str(),"%d-%d-%d%c",&y,&m,&d,&end) != 3 || m < 1 || m > 12 || d < 1 || d > 31)
+                return 0;
+
+            return y * 10000 + m * 100 + d;
+        }
+
+        bool active() const
+        {
+            return enabled;
+        }
+
+        bool is_open(time_t t) const
+        {
+            if(!enabled)
+                return true;
+
+            struct tm tm;
+
+            local_time(t,tm);
+
+            int secs = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+
+            return trading_day(t) && secs >= open_at && secs < close_at;
+        }
+
+        // Whether a trade may be recorded at t, counting those that may not
+
+        bool admit(time_t t)
+        {
+            if(is_open(t))
+                return true;
+
+            refused++;
+            return false;
+        }
+
+        bool set_hours(int open,int close)
+        {
+            if(open < 0 || close <= open || close > 24 * 3600)
+                return false;
+
+            open_at = open;
+            close_at = close;
+            enabled = true;
+            next_close = close_after(engine_time.now());
+
+            return true;
+        }
+
+        void disable()
+        {
+            enabled = false;
+        }
+
+        void add_holiday(int day)
+        {
+            std::vector<int>::iterator h = std::lower_bound(holidays.begin(),holidays.end(),day);
+
+            if(h == holidays.end() || *h != day)
+                holidays.insert(h,day);
+
+            if(enabled)
+                next_close = close_after(engine_time.now());
+        }
+
+        bool drop_holiday(int day)
+        {
+            std::vector<int>::iterator h = std::lower_bound(holidays.begin(),holidays.end(),day);
+
+            if(h == holidays.end() || *h != day)
+                return false;
+
+            holidays.erase(h);
+
+            if(enabled)
+                next_close = close_after(engine_time.now());
+
+            return true;
+        }
+
+        // Whether a close has passed by 'now', giving the day it closed.
+        // Closes missed while idle count as one.
+
+        bool due(time_t now,int &day)
+        {
+            if(!enabled || !next_close || now < next_close)
+                return false;
+
+            day = day_of(next_close - 1);
+            next_close = close_after(now);
+
+            return true;
+        }
+
+        void show() const
+        {
+            char when[32];
+
+            if(!enabled)
+            {
+                std::cout << "No trading hours set, the market never closes" << std::endl;
+                return;
+            }
+
+            std::cout << "Open " << std::setfill('0') << std::setw(2) << open_at / 3600 << ":" << std::setw(2) << open_at / 60 % 60;
+            std::cout << " to " << std::setw(2) << close_at / 3600 << ":" << std::setw(2) << close_at / 60 % 60;
+            std::cout << std::setfill(' ') << " Monday to Friday, " << holidays.size() << " holidays";
+
+            for(size_t i = 0; i < holidays.size(); i++)
+                std::cout << (i ? ", " : ": ") << holidays[i];
+
+            std::cout << std::endl;
+
+            if(refused)
+                std::cout << refused << " trades refused while the market was closed" << std::endl;
+
+            if(next_close)
+            {
+                strftime(when,sizeof(when),"%a %Y-%m-%d %H:%M",localtime(&next_close));
+                std::cout << "Market is " << (is_open(engine_time.now()) ? "open" : "closed") << ", next close " << when << std::endl;
+            }
+        }
+};
+
+session_calendar sessions;
+
+// Ends sessions and writes them to cold storage
+
+class archiver
+{
+    private:
+
+        struct job
+        {
+            int         day;
+            trade_store trades;
+            std::vector<day_bar> bars;
+        };
+
+        std::mutex  lock;
+        std::condition_variable work;
+        std::vector<job *> jobs;
+        std::thread worker;
+        bool        stopping;
+
+        trade_store spare;                  // An archived store, kept for its room
+        std::string dir;
+
+        std::vector<day_bar> closing;       // Bars of the last session (engine_lock)
+        uint64_t    close_ns;               // Time the engine was held by the last close
+        size_t      days;
+        size_t      archived;               // Trades written
+        uint64_t    write_ns;               // Time the last archive took
+        size_t      failures;
+
+        std::string path(const char *name,int day) const
+        {
+            std::ostringstream os;
+
+            os << (dir.empty() ? "." : dir) << "/" << name;
+
+            if(day)
+                os << "-" << day;
+
+            os << ".csv";
+
+            return os.str();
+        }
+
+        bool write(const job &j)
+        {
+            std::ofstream trades(path("trades",j.day).c_str(),std::ios::app);
+            std::ofstream bars(path("bars",0).c_str(),std::ios::app);
+
+            if(!trades || !bars)
+                return false;
+
+            if(trades.tellp() == 0)
+                trades << "stamp,symbol,account,operation,quantity,price\n";
+
+            if(bars.tellp() == 0)
+                bars << "day,symbol,open,high,low,close,volume,value,trades\n";
+
+            trades << std::setprecision(10);
+            bars << std::setprecision(10);
+
+            for(trade_store::const_iterator op = j.trades.begin(); op != j.trades.end(); op++)
+            {
+                trades << op->stamp << "," << op->symbol << "," << op->account << "," << (op->operation == BUY_STOCK ? "BUY" : "SELL");
+                trades << "," << op->quantity << "," << op->price << "\n";
+            }
+
+            for(size_t i = 0; i < j.bars.size(); i++)
+            {
+                const day_bar &b = j.bars[i];
+
+                bars << b.day << "," << b.symbol << "," << b.open << "," << b.high << "," << b.low << ",";
+                bars << b.close << "," << b.volume << "," << b.value << "," << b.trades << "\n";
+            }
+
+            trades.flush();
+            bars.flush();
+
+            return trades.good() && bars.good();
+        }
+
+        void run()
+        {
+            topology.join(ROLE_PERSISTENCE,"archiver");
+
+            std::unique_lock<std::mutex> guard(lock);
+
+            for(;;)
+            {
+                while(jobs.empty() && !stopping)
+                    work.wait(guard);
+
+                if(jobs.empty())
+                    break;
+
+                job *j = jobs.front();
+                jobs.erase(jobs.begin());
+
+                guard.unlock();
+
+                uint64_t start = now_ns();
+                bool ok = write(*j);
+                size_t n = j->trades.size();
+
+                j->trades.clear();
+
+                // If no trade came in yet trade_db can have the room back
+                // now, else keep the biggest store for a later day
+
+                {
+                    std::lock_guard<std::mutex> engine(engine_lock);
+
+                    if(trade_db.empty() && trade_db.capacity() < j->trades.capacity())
+                    {
+                        trade_db.swap(j->trades);
+                        telemetry.trade_db_capacity.store(trade_db.capacity(),std::memory_order_relaxed);
+                    }
+                }
+
+                guard.lock();
+
+                write_ns = now_ns() - start;
+                archived += n;
+                failures += !ok;
+
+                if(j->trades.capacity() > spare.capacity())
+                    spare.swap(j->trades);
+
+                delete j;
+            }
+
+            guard.unlock();
+            topology.leave();
+        }
+
+    public:
+
+        archiver() : stopping(false), close_ns(0), days(0), archived(0), write_ns(0), failures(0)
+        {
+        }
+
+        // Finish writing what was queued
+
+        ~archiver()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+
+            work.notify_one();
+
+            if(worker.joinable())
+                worker.join();
+        }
+
+        void set_dir(const std::string &d)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            dir = d;
+        }
+
+        // End the session of 'day'. Called with engine_lock held; the
+        // trades are written in the background.
+
+        void close(int day)
+        {
+            uint64_t start = now_ns();
+            job *j = new job;
+
+            j->day = day;
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                j->trades.swap(spare);
+            }
+
+            gbce.end_of_day(day,j->trades,j->bars);
+            closing = j->bars;
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                jobs.push_back(j);
+                days++;
+
+                if(!worker.joinable())
+                    worker = std::thread(&archiver::run,this);
+            }
+
+            work.notify_one();
+
+            close_ns = now_ns() - start;
+        }
+
+        // The last session's bars (engine_lock held)
+
+        void show_bars() const
+        {
+            if(closing.empty())
+            {
+                std::cout << "No session closed yet" << std::endl;
+                return;
+            }
+
+            std::cout << std::setprecision(2) << std::fixed;
+            std::cout << "Session " << closing[0].day << std::endl;
+
+            for(size_t i = 0; i < closing.size(); i++)
+            {
+                const day_bar &b = closing[i];
+
+                std::cout << std::setw(5) << b.symbol << "  O " << std::setw(8) << b.open << "  H " << std::setw(8) << b.high;
+                std::cout << "  L " << std::setw(8) << b.low << "  C " << std::setw(8) << b.close;
+                std::cout << "  V " << std::setw(10) << b.volume << "  " << b.trades << " trades" << std::endl;
+            }
+        }
+
+        void show()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            std::cout << days << " sessions closed, last held the engine " << close_ns / 1000 << " us; ";
+            std::cout << archived << " trades archived to " << (dir.empty() ? "." : dir) << ", last in ";
+            std::cout << write_ns / 1000000 << " ms, " << jobs.size() << " pending";
+
+            if(failures)
+                std::cout << ", " << failures << " FAILED";
+
+            std::cout << std::endl;
+        }
+};
+
+archiver archive;
+
+// End the session if its close has passed (engine_lock held)
+
+void session_tick(time_t now)
+{
+    int day;
+
+    if(sessions.due(now,day))
+        archive.close(day);
+}
+
+#ifdef __linux__
+
+/*
+    Market data feed.
+
+    Trades arrive as sequenced UDP packets (MoldUDP64 style): a header
+    giving the session, the sequence number of the first message and the
+    message count, followed by that many fixed size trade messages. The
+    sequence number of the next expected message is kept so lost packets
+    are detected as gaps and duplicated ones are dropped.
+
+    Host byte order is used on the wire, which is fine for loopback and
+    for the little-endian hosts we run on.
+*/
+
+#define FEED_MAGIC      0x44454546      // "FEED"
+#define FEED_MTU        1472            // Largest UDP payload in one Ethernet frame
+#define FEED_BATCH      64              // Packets taken per recvmmsg() call
+#define FEED_LAT_STEP   100             // Latency histogram bucket, in nanoseconds
+#define FEED_LAT_BUCKETS 1000           // Buckets up to 100us, one more for the rest
+
+#pragma pack(push,1)
+
+struct feed_header
+{
+    uint32_t    magic;          // FEED_MAGIC
+    uint32_t    session;        // Changes when the sender restarts numbering
+    uint64_t    sequence;       // Sequence number of the first message
+    uint16_t    count;          // Trade messages following the header
+};
+
+struct feed_trade
+{
+    uint64_t    stamp;          // Exchange time, nanoseconds since the epoch
+    char        symbol[TICKER_LEN]; // NUL padded
+    char        account[TICKER_LEN];
+    uint32_t    quantity;
+    uint8_t     operation;      // BUY_STOCK or SELL_STOCK
+    double      price;
+};
+
+#pragma pack(pop)
+
+#define FEED_MAX_TRADES ((FEED_MTU - sizeof(feed_header)) / sizeof(feed_trade))
+
+// A decoded trade message waiting to be applied, with its packet's
+// kernel receive stamp for latency accounting.
+
+struct feed_msg
+{
+    feed_trade      trade;
+    struct timespec rx;
+};
+
+/*
+    Single producer, single consumer queue between the feed's network
+    thread and the ingestion thread. 'signal' is a futex word the
+    consumer may sleep on; the producer only pays for a wake up system
+    call when the consumer announced it is going to sleep.
+*/
+
+#define INGEST_QUEUE    65536           // Messages, must be a power of two
+
+class ingest_queue
+{
+    private:
+
+        std::vector<feed_msg,huge_allocator<feed_msg> > buf;
+
+        alignas(64) std::atomic<uint64_t> head;     // Next to pop (consumer)
+        alignas(64) std::atomic<uint64_t> tail;     // Next to push (producer)
+        alignas(64) std::atomic<int>      signal;
+        std::atomic<bool>       sleeping;
+
+    public:
+
+        ingest_queue() : head(0), tail(0), signal(0), sleeping(false)
+        {
+        }
+
+        // Allocate the buffer on first use, so it gets the page size
+        // configured by then.
+
+        void init()
+        {
+            if(buf.empty())
+                buf.resize(INGEST_QUEUE);
+        }
+
+        bool empty() const
+        {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+        bool push(const feed_msg &m)
+        {
+            uint64_t t = tail.load(std::memory_order_relaxed);
+
+            if(t - head.load(std::memory_order_acquire) == buf.size())
+                return false;
+
+            buf[t & (buf.size() - 1)] = m;
+            tail.store(t + 1,std::memory_order_release);
+
+            return true;
+        }
+
+        // Make a sleeping consumer runnable (producer side, after pushing)
+
+        void wake()
+        {
+            // The push's store to 'tail' must be seen before we look at
+            // 'sleeping', as block() must store 'sleeping' before looking
+            // at 'tail', or each can miss the other
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if(sleeping.load(std::memory_order_seq_cst))
+            {
+                signal.fetch_add(1,std::memory_order_seq_cst);
+                syscall(SYS_futex,&signal,FUTEX_WAKE_PRIVATE,1,NULL,NULL,0);
+            }
+        }
+
+        // Take up to max messages, returns how many
+
+        size_t pop(feed_msg *out,size_t max)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            uint64_t n = std::min((uint64_t)max,tail.load(std::memory_order_acquire) - h);
+
+            for(uint64_t i = 0; i < n; i++)
+                out[i] = buf[(h + i) & (buf.size() - 1)];
+
+            head.store(h + n,std::memory_order_release);
+
+            return n;
+        }
+
+        // Sleep until the producer pushes or wakes us, at most 'ms'
+
+        void block(int ms)
+        {
+            int seen = signal.load(std::memory_order_seq_cst);
+            struct timespec tmo = { 0, ms * 1000000L };
+
+            sleeping.store(true,std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if(empty())
+                syscall(SYS_futex,&signal,FUTEX_WAIT_PRIVATE,seen,&tmo,NULL,0);
+
+            sleeping.store(false,std::memory_order_seq_cst);
+        }
+};
+
+/*
+    How the ingestion thread waits for work. Spinning answers fastest but
+    burns a core; blocking frees the core but pays a wake up per burst.
+    The adaptive strategy sizes its spin and yield phases from the
+    observed time between arrivals: on a busy feed the next message is
+    usually a few microseconds away and worth spinning for, on a quiet
+    one it blocks almost straight away.
+*/
+
+enum
+{
+    WAIT_SPIN = 0,      // Busy poll, never leave the core
+    WAIT_YIELD,         // Poll, yielding the core between polls
+    WAIT_BLOCK,         // Sleep on the futex until woken
+    WAIT_ADAPTIVE,      // Spin, then yield, then block as arrivals suggest
+};
+
+#define WAIT_SPIN_MAX   100000          // Longest adaptive spin phase, nanoseconds
+#define WAIT_YIELD_MAX  1000000         // Longest adaptive yield phase, nanoseconds
+
+const char *wait_names[] = { "spin", "yield", "block", "adaptive" };
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+class feed_handler
+{
+    private:
+
+        int                 sock;
+        int                 port;
+        std::thread         network;
+        std::thread         ingestion;
+        std::atomic<bool>   running;
+        std::atomic<int>    strategy;
+        ingest_queue        queue;
+
+        // Sequencing state, owned by the network thread
+
+        bool        synced;
+        uint32_t    session;
+        uint64_t    expected;
+
+        // Network thread statistics (read from other threads)
+
+        std::atomic<uint64_t> packets;
+        std::atomic<uint64_t> gaps;
+        std::atomic<uint64_t> lost;
+        std::atomic<uint64_t> duplicates;
+        std::atomic<uint64_t> malformed;
+        std::atomic<uint64_t> stalls;
+        std::atomic<uint64_t> gap_from;
+        std::atomic<uint64_t> gap_to;
+
+        // Ingestion thread statistics, only touched under engine_lock
+
+        uint64_t    messages;
+        uint64_t    unknown;
+        uint64_t    closed;             // Refused, the market being closed
+        uint64_t    batches;
+        uint64_t    woke[4];            // Work found while spinning, yielding, blocking
+        uint64_t    arrival_gap;        // Average time between arrivals, nanoseconds
+
+        uint64_t    lat_count;
+        uint64_t    lat_sum;
+        uint64_t    lat_min;
+        uint64_t    lat_max;
+        std::vector<uint64_t> lat_hist;
+
+        void clear_stats()
+        {
+            synced = false;
+            session = 0;
+            expected = 0;
+            packets = gaps = lost = duplicates = malformed = stalls = 0;
+            gap_from = gap_to = 0;
+            messages = unknown = closed = batches = 0;
+            woke[0] = woke[1] = woke[2] = woke[3] = 0;
+            arrival_gap = WAIT_YIELD_MAX;
+            lat_count = lat_sum = lat_max = 0;
+            lat_min = ~(uint64_t)0;
+            lat_hist.assign(FEED_LAT_BUCKETS + 1,0);
+        }
+
+        // Latency percentile from the histogram, in nanoseconds
+
+        uint64_t percentile(double p) const
+        {
+            uint64_t want = (uint64_t)(p * lat_count),seen = 0;
+
+            for(size_t i = 0; i < lat_hist.size(); i++)
+            {
+                seen += lat_hist[i];
+                if(seen > want)
+                    return (i < FEED_LAT_BUCKETS) ? (i + 1) * FEED_LAT_STEP : lat_max;
+            }
+            return lat_max;
+        }
+
+        // Check sequencing of a packet and queue its new trades
+
+        void decode(const char *buf,size_t len,const struct timespec &rx)
+        {
+            feed_header h;
+            uint64_t first = 0;
+
+            if(len < sizeof(h))
+            {
+                malformed++;
+                return;
+            }
+
+            memcpy(&h,buf,sizeof(h));
+
+            if(h.magic != FEED_MAGIC || len < sizeof(h) + h.count * sizeof(feed_trade))
+            {
+                malformed++;
+                return;
+            }
+
+            packets++;
+
+            // A new session restarts numbering
+
+            if(!synced || h.session != session)
+            {
+                synced = true;
+                session = h.session;
+                expected = h.sequence;
+            }
+
+            if(h.sequence > expected)
+            {
+                gaps++;
+                lost += h.sequence - expected;
+                gap_from = expected;
+                gap_to = h.sequence - 1;
+                expected = h.sequence;
+            }
+            else if(h.sequence < expected)
+            {
+                // Partially or fully seen before
+
+                first = expected - h.sequence;
+                if(first >= h.count)
+                {
+                    duplicates++;
+                    return;
+                }
+            }
+
+            for(uint64_t i = first; i < h.count; i++)
+            {
+                feed_msg m;
+
+                memcpy(&m.trade,buf + sizeof(h) + i * sizeof(m.trade),sizeof(m.trade));
+                m.rx = rx;
+
+                // Quantities must fit trade_op's int, as for text ingest
+
+                if(!std::isfinite(m.trade.price) || m.trade.price < 0 || !m.trade.quantity || m.trade.quantity > 0x7fffffff)
+                {
+                    malformed++;
+                    continue;
+                }
+
+                // Back pressure: a full queue leaves packets in the socket buffer
+
+                if(!queue.push(m))
+                {
+                    stalls++;
+                    queue.wake();
+
+                    while(!queue.push(m))
+                        std::this_thread::yield();
+                }
+            }
+
+            expected = h.sequence + h.count;
+        }
+
+        // The network thread: take whatever packets are queued in one
+        // system call and hand their trades to the ingestion thread.
+
+        void network_run()
+        {
+            static char bufs[FEED_BATCH][FEED_MTU];
+            static char ctrl[FEED_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+            struct mmsghdr msgs[FEED_BATCH];
+            struct iovec iov[FEED_BATCH];
+
+            topology.join(ROLE_NETWORK,"feed receiver");
+
+            while(running)
+            {
+                memset(msgs,0,sizeof(msgs));
+
+                for(int i = 0; i < FEED_BATCH; i++)
+                {
+                    iov[i].iov_base = bufs[i];
+                    iov[i].iov_len = FEED_MTU;
+                    msgs[i].msg_hdr.msg_iov = &iov[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                    msgs[i].msg_hdr.msg_control = ctrl[i];
+                    msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+                }
+
+                // Blocks for the first packet only (or the receive timeout,
+                // which lets us notice a stop request).
+
+                int n = recvmmsg(sock,msgs,FEED_BATCH,MSG_WAITFORONE,NULL);
+
+                if(n <= 0)
+                    continue;
+
+                for(int i = 0; i < n; i++)
+                {
+                    struct timespec rx = { 0, 0 };
+                    struct cmsghdr *cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+
+                    for(; cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr,cm))
+                    {
+                        if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS)
+                            memcpy(&rx,CMSG_DATA(cm),sizeof(rx));
+                    }
+
+                    decode(bufs[i],msgs[i].msg_len,rx);
+                }
+
+                queue.wake();
+            }
+
+            topology.leave();
+        }
+
+        // Wait for the queue to have work following the current strategy.
+        // Returns the phase that found it (a WAIT_ value), or -1 on stop.
+
+        int wait_for_work()
+        {
+            int s = strategy;
+            uint64_t spin_ns,yield_ns,start = now_ns();
+
+            switch(s)
+            {
+                case WAIT_SPIN:
+                    spin_ns = ~(uint64_t)0;
+                    yield_ns = 0;
+                    break;
+                case WAIT_YIELD:
+                    spin_ns = 0;
+                    yield_ns = ~(uint64_t)0;
+                    break;
+                case WAIT_BLOCK:
+                    spin_ns = yield_ns = 0;
+                    break;
+                default:
+                    spin_ns = (arrival_gap < WAIT_SPIN_MAX) ? 2 * arrival_gap : 0;
+                    yield_ns = (arrival_gap < WAIT_YIELD_MAX) ? 2 * arrival_gap : 0;
+                    break;
+            }
+
+            while(running)
+            {
+                if(!queue.empty())
+                    return WAIT_SPIN;
+                if(now_ns() - start >= spin_ns)
+                    break;
+                cpu_relax();
+            }
+
+            start = now_ns();
+
+            while(running)
+            {
+                if(!queue.empty())
+                    return WAIT_YIELD;
+                if(now_ns() - start >= yield_ns)
+                    break;
+                std::this_thread::yield();
+            }
+
+            while(running)
+            {
+                if(!queue.empty())
+                    return WAIT_BLOCK;
+                queue.block(100);
+            }
+
+            return -1;
+        }
+
+        // The ingestion thread: apply queued trades under one lock per
+        // batch and reprice the stocks they traded.
+
+        void ingestion_run()
+        {
+            static feed_msg batch[1024];
+            std::vector<stock *> touched;
+            uint64_t last = now_ns();
+
+            topology.join(ROLE_INGESTION,"feed ingestion");
+
+            for(;;)
+            {
+                int phase = WAIT_SPIN;
+
+                if(queue.empty())
+                    phase = wait_for_work();
+
+                if(phase < 0)
+                    break;
+
+                size_t n = queue.pop(batch,sizeof(batch) / sizeof(batch[0]));
+                uint64_t t = now_ns();
+
+                std::lock_guard<std::mutex> lock(engine_lock);
+
+                session_tick(engine_time.now());
+
+                // Track the time between arrivals for the adaptive strategy
+
+                arrival_gap = (7 * arrival_gap + (t - last)) / 8;
+                last = t;
+
+                woke[phase]++;
+                touched.clear();
+
+                time_t clock = engine_time.now();
+
+                for(size_t i = 0; i < n; i++)
+                {
+                    const feed_trade &m = batch[i].trade;
+
+                    if(!sessions.admit(clock))
+                    {
+                        messages++;
+                        closed++;
+                        continue;
+                    }
+
+                    stock *st = gbce.record(trade_op(ticker(m.symbol,sizeof(m.symbol)),m.operation,m.quantity,m.price,
+                                                     (time_t)(m.stamp / 1000000000ULL),ticker(m.account,sizeof(m.account))));
+                    messages++;
+                    bump(telemetry.feed_messages);
+
+                    if(!st)
+                    {
+                        unknown++;
+                        continue;
+                    }
+
+                    size_t k = 0;
+                    while(k < touched.size() && touched[k] != st)
+                        k++;
+                    if(k == touched.size())
+                        touched.push_back(st);
+                }
+
+                for(size_t i = 0; i < touched.size(); i++)
+                    gbce.reprice(touched[i]);
+
+                if(queue.empty())
+                    tape_local.flush();
+
+                batches++;
+
+                // Packet to price update latency, from the kernel receive stamp
+
+                struct timespec now;
+                clock_gettime(CLOCK_REALTIME,&now);
+
+                for(size_t i = 0; i < n; i++)
+                {
+                    const struct timespec &rx = batch[i].rx;
+
+                    if(!rx.tv_sec)
+                        continue;
+
+                    int64_t ns = (int64_t)(now.tv_sec - rx.tv_sec) * 1000000000LL +
+                                 (now.tv_nsec - rx.tv_nsec);
+                    if(ns < 0)
+                        ns = 0;
+
+                    lat_count++;
+                    lat_sum += ns;
+                    if((uint64_t)ns < lat_min)
+                        lat_min = ns;
+                    if((uint64_t)ns > lat_max)
+                        lat_max = ns;
+                    lat_hist[std::min((uint64_t)ns / FEED_LAT_STEP,(uint64_t)FEED_LAT_BUCKETS)]++;
+                    telemetry.feed_latency.observe(ns);
+                }
+            }
+
+            topology.leave();
+        }
+
+    public:
+
+        feed_handler() : sock(-1), port(0), running(false), strategy(WAIT_ADAPTIVE)
+        {
+            clear_stats();
+        }
+
+        ~feed_handler()
+        {
+            stop();
+        }
+
+        bool active() const
+        {
+            return running;
+        }
+
+        int get_port() const
+        {
+            return port;
+        }
+
+        // Allocate the queue now rather than when the feed starts
+
+        void reserve()
+        {
+            queue.init();
+        }
+
+        // Choose how the ingestion thread waits, takes effect on its next wait
+
+        void set_strategy(int s)
+        {
+            strategy = s;
+            queue.wake();
+        }
+
+        int get_strategy() const
+        {
+            return strategy;
+        }
+
+        // Messages accounted so far (call under engine_lock)
+
+        uint64_t received() const
+        {
+            return messages + duplicates;
+        }
+
+        // Start listening on a port, joining a multicast group if given.
+        // Must be called without holding engine_lock.
+
+        bool start(int p,const char *group)
+        {
+            if(running)
+                return false;
+
+            sock = socket(AF_INET,SOCK_DGRAM,0);
+            if(sock < 0)
+                return false;
+
+            int on = 1,rcvbuf = 8 << 20;
+            struct timeval tv = { 0, 200000 };
+
+            setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+            setsockopt(sock,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+            setsockopt(sock,SOL_SOCKET,SO_TIMESTAMPNS,&on,sizeof(on));
+            setsockopt(sock,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+
+            struct sockaddr_in addr;
+            memset(&addr,0,sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(p);
+            addr.sin_addr.s_addr = htonl(group ? INADDR_ANY : INADDR_LOOPBACK);
+
+            if(bind(sock,(struct sockaddr *)&addr,sizeof(addr)) < 0)
+            {
+                close(sock);
+                sock = -1;
+                return false;
+            }
+
+            if(group)
+            {
+                struct ip_mreq mr;
+                mr.imr_multiaddr.s_addr = inet_addr(group);
+                mr.imr_interface.s_addr = htonl(INADDR_ANY);
+
+                if(setsockopt(sock,IPPROTO_IP,IP_ADD_MEMBERSHIP,&mr,sizeof(mr)) < 0)
+                {
+                    close(sock);
+                    sock = -1;
+                    return false;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(engine_lock);
+                clear_stats();
+            }
+
+            queue.init();
+
+            port = p;
+            running = true;
+            ingestion = std::thread(&feed_handler::ingestion_run,this);
+            network = std::thread(&feed_handler::network_run,this);
+
+            return true;
+        }
+
+        // Stop both threads. Must be called without holding engine_lock.
+
+        void stop()
+        {
+            if(!running)
+                return;
+
+            running = false;
+            network.join();
+            queue.wake();
+            ingestion.join();
+            close(sock);
+            sock = -1;
+        }
+
+        // Wait until the socket looks drained (a few idle polls, two
+        // seconds at most). Must be called without holding engine_lock.
+
+        void settle()
+        {
+            uint64_t last = ~(uint64_t)0;
+            int idle = 0;
+
+            for(int i = 0; i < 200 && idle < 5; i++)
+            {
+                uint64_t now;
+                {
+                    std::lock_guard<std::mutex> lock(engine_lock);
+                    now = received();
+                }
+
+                idle = (now == last) ? idle + 1 : 0;
+                last = now;
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        // The network thread's counters for the metrics endpoint
+
+        void render_metrics(std::ostream &os) const
+        {
+            metric(os,"ssstock_feed_packets_total","counter","Feed packets received",packets);
+            metric(os,"ssstock_feed_messages_total","counter","Feed trades applied",telemetry.feed_messages);
+            metric(os,"ssstock_feed_gaps_total","counter","Feed sequence gaps",gaps);
+            metric(os,"ssstock_feed_lost_total","counter","Feed messages lost in gaps",lost);
+            metric(os,"ssstock_feed_duplicates_total","counter","Feed messages dropped as duplicates",duplicates);
+            metric(os,"ssstock_feed_queue_full_total","counter","Times the ingestion queue was full",stalls);
+
+            telemetry.feed_latency.render(os,"ssstock_feed_latency_seconds","Packet receipt to price update");
+        }
+
+        void show_stats() const
+        {
+            std::cout << "Feed " << (running ? "listening on port " : "stopped, last port ") << port << std::endl;
+            std::cout << "    packets    " << packets << std::endl;
+            std::cout << "    messages   " << messages << " in " << batches << " batches (";
+            std::cout << unknown << " unknown symbols, " << closed << " refused while closed)" << std::endl;
+            std::cout << "    gaps       " << gaps << " (" << lost << " messages lost";
+            if(gaps)
+                std::cout << ", last " << gap_from << "-" << gap_to;
+            std::cout << ")" << std::endl;
+            std::cout << "    duplicates " << duplicates << std::endl;
+            std::cout << "    malformed  " << malformed << std::endl;
+            std::cout << "    queue full " << stalls << std::endl;
+            std::cout << "    waiting    " << wait_names[strategy] << ", work found ";
+            std::cout << woke[WAIT_SPIN] << " spinning, " << woke[WAIT_YIELD] << " yielding, ";
+            std::cout << woke[WAIT_BLOCK] << " blocked, arrivals every ";
+            std::cout << std::setprecision(2) << std::fixed << arrival_gap / 1000.0 << " us" << std::endl;
+
+            if(lat_count)
+            {
+                std::cout << std::setprecision(2) << std::fixed;
+                std::cout << "    latency us min " << lat_min / 1000.0;
+                std::cout << " avg " << (lat_sum / (double)lat_count) / 1000.0;
+                std::cout << " p50 " << percentile(0.50) / 1000.0;
+                std::cout << " p99 " << percentile(0.99) / 1000.0;
+                std::cout << " max " << lat_max / 1000.0 << std::endl;
+            }
+        }
+};
+
+/*
+    A replayer for the feed: sends 'trades' random trades of the given
+    symbols to a port on the loopback (or to a multicast group), packed
+    'per_packet' to a packet. If drop_every is not zero one packet in
+    every drop_every is numbered but not sent, to exercise gap detection.
+    A non zero 'rate' paces sending to that many packets per second.
+*/
+
+int feed_replay(const std::vector<ticker> &symbols,int port,long trades,
+                int per_packet,int drop_every,int rate,const char *group)
+{
+    int sock = socket(AF_INET,SOCK_DGRAM,0);
+    if(sock < 0 || symbols.empty())
+        return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = group ? inet_addr(group) : htonl(INADDR_LOOPBACK);
+
+    if(group)
+    {
+        unsigned char loop = 1;
+        setsockopt(sock,IPPROTO_IP,IP_MULTICAST_LOOP,&loop,sizeof(loop));
+    }
+
+    if(per_packet < 1 || per_packet > (int)FEED_MAX_TRADES)
+        per_packet = FEED_MAX_TRADES;
+
+    char buf[FEED_MTU];
+    feed_header h;
+    int sent = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME,&now);
+
+    h.magic = FEED_MAGIC;
+    h.session = (uint32_t)(now.tv_sec ^ now.tv_nsec);
+    h.sequence = 1;
+
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+    for(long pkt = 0; trades > 0; pkt++)
+    {
+        if(rate > 0)
+        {
+            next += std::chrono::nanoseconds(1000000000LL / rate);
+            std::this_thread::sleep_until(next);
+        }
+
+        clock_gettime(CLOCK_REALTIME,&now);
+
+        h.count = (uint16_t)std::min((long)per_packet,trades);
+
+        for(int i = 0; i < h.count; i++)
+        {
+            feed_trade m;
+            memset(&m,0,sizeof(m));
+            m.stamp = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+            symbols[rand() % symbols.size()].copy(m.symbol);
+            random_account().copy(m.account);
+            m.quantity = 1 + (rand() % 109);
+            m.operation = (rand() & 1) ? BUY_STOCK : SELL_STOCK;
+            m.price = 0.41 + ((double)(rand() % 299) / 100.0);
+
+            memcpy(buf + sizeof(h) + i * sizeof(m),&m,sizeof(m));
+        }
+
+        memcpy(buf,&h,sizeof(h));
+
+        if(!drop_every || (pkt % drop_every) != drop_every - 1)
+        {
+            if(sendto(sock,buf,sizeof(h) + h.count * sizeof(feed_trade),0,
+                      (struct sockaddr *)&addr,sizeof(addr)) > 0)
+                sent++;
+        }
+
+        h.sequence += h.count;
+        trades -= h.count;
+    }
+
+    close(sock);
+
+    return sent;
+}
+
+feed_handler feed;
+startup_mark startup_feed("feed");
+
+/*
+    Metrics endpoint: a small HTTP server on the loopback answering
+    GET /metrics with the telemetry in Prometheus text format. It only
+    reads atomics, so a scrape never holds up trading.
+*/
+
+void render_metrics(std::ostream &os)
+{
+    std::ios saved_format(NULL);
+
+    saved_format.copyfmt(os);
+    os << std::setprecision(10);
+    os.unsetf(std::ios::floatfield);
+
+    metric(os,"ssstock_trades_total","counter","Trades recorded",telemetry.trades);
+    metric(os,"ssstock_trade_db_size","gauge","Trades in trade_db",telemetry.trade_db_size);
+    metric(os,"ssstock_trade_db_capacity","gauge","Trades trade_db has room for",telemetry.trade_db_capacity);
+    metric(os,"ssstock_price_updates_total","counter","Stock price updates",telemetry.price_updates);
+    metric(os,"ssstock_index","gauge","GBCE All Share Index",telemetry.get_index());
+    metric(os,"ssstock_stocks","gauge","Stocks in the index",telemetry.stocks);
+    metric(os,"ssstock_commands_total","counter","Commands processed",telemetry.commands);
+    metric(os,"ssstock_sessions_closed_total","counter","Trading sessions closed",telemetry.sessions);
+    metric(os,"ssstock_page_faults_total","counter","Page faults taken by the process",(uint64_t)page_faults());
+    metric(os,"ssstock_startup_seconds","gauge","Time from static construction to the first prompt",startup.elapsed("ready") / 1e9);
+
+    telemetry.reprice.render(os,"ssstock_reprice_seconds","Time to reprice one stock");
+
+    feed.render_metrics(os);
+
+    os.copyfmt(saved_format);
+}
+
+class metrics_server
+{
+    private:
+
+        int         sock;
+        int         port;
+        std::atomic<bool> running;
+        std::atomic<uint64_t> scrapes;
+        std::thread worker;
+
+        void answer(int client)
+        {
+            char req[4096];
+            size_t len = 0;
+            ssize_t n;
+
+            // Read the request head, the first line is all we look at
+
+            while(len < sizeof(req) - 1 && (n = recv(client,req + len,sizeof(req) - 1 - len,0)) > 0)
+            {
+                len += n;
+                req[len] = 0;
+
+                if(strstr(req,"\r\n\r\n") || strstr(req,"\n\n"))
+                    break;
+            }
+
+            req[len] = 0;
+
+            std::ostringstream body,head;
+            const char *status = "200 OK";
+
+            if(!strncmp(req,"GET /metrics ",13) || !strncmp(req,"GET /metrics?",13))
+            {
+                render_metrics(body);
+                scrapes++;
+            }
+            else
+            {
+                status = "404 Not Found";
+                body << "Try /metrics\n";
+            }
+
+            std::string text = body.str();
+
+            head << "HTTP/1.1 " << status << "\r\n";
+            head << "Content-Type: text/plain; version=0.0.4\r\n";
+            head << "Content-Length: " << text.size() << "\r\n";
+            head << "Connection: close\r\n\r\n";
+
+            std::string reply = head.str() + text;
+
+            for(size_t sent = 0; sent < reply.size(); sent += n)
+                if((n = send(client,reply.data() + sent,reply.size() - sent,MSG_NOSIGNAL)) <= 0)
+                    break;
+        }
+
+        void run()
+        {
+            topology.join(ROLE_ANALYTICS,"metrics server");
+
+            while(running)
+            {
+                int client = accept(sock,NULL,NULL);
+
+                if(client < 0)
+                    continue;               // Timed out, check running
+
+                struct timeval tv = { 1, 0 };
+
+                setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+                answer(client);
+                close(client);
+            }
+
+            topology.leave();
+        }
+
+    public:
+
+        metrics_server() : sock(-1), port(0), running(false), scrapes(0)
+        {
+        }
+
+        ~metrics_server()
+        {
+            stop();
+        }
+
+        bool start(int p)
+        {
+            if(running)
+                return false;
+
+            sock = socket(AF_INET,SOCK_STREAM,0);
+            if(sock < 0)
+                return false;
+
+            int on = 1;
+            struct timeval tv = { 0, 200000 };
+
+            setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+            setsockopt(sock,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+
+            struct sockaddr_in addr;
+            memset(&addr,0,sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(p);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            if(bind(sock,(struct sockaddr *)&addr,sizeof(addr)) < 0 || listen(sock,16) < 0)
+            {
+                close(sock);
+                sock = -1;
+                return false;
+            }
+
+            port = p;
+            running = true;
+            worker = std::thread(&metrics_server::run,this);
+
+            return true;
+        }
+
+        void stop()
+        {
+            if(!running)
+                return;
+
+            running = false;
+            worker.join();
+            close(sock);
+            sock = -1;
+        }
+
+        bool active() const
+        {
+            return running;
+        }
+
+        void show() const
+        {
+            std::cout << "Metrics " << (running ? "served on http://127.0.0.1:" : "not served, last port ") << port;
+            std::cout << "/metrics, " << scrapes << " scrapes" << std::endl;
+        }
+};
+
+metrics_server metrics_http;
+
+#endif
+
+
+/*
+    Benchmarks
+*/
+
+#ifdef __linux__
+
+// Count user space data TLB read misses of this thread (-1 if not allowed)
+
+int perf_dtlb_open()
+{
+    struct perf_event_attr pe;
+
+    memset(&pe,0,sizeof(pe));
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open,&pe,0,-1,-1,0);
+}
+
+// Kilobytes of this process backed by transparent huge pages
+
+long thp_kbytes()
+{
+    FILE *f = fopen("/proc/self/smaps_rollup","r");
+    char line[256];
+    long kb = 0;
+
+    if(!f)
+        return -1;
+
+    while(fgets(line,sizeof(line),f))
+        if(!strncmp(line,"AnonHugePages:",14))
+            kb = atol(line + 14);
+
+    fclose(f);
+
+    return kb;
+}
+
+#endif
+
+/*
+    Random dependent reads over a table of 'mb' megabytes, once on normal
+    pages and once on huge pages (the configured kind, or THP if huge
+    pages are off), reporting time and data TLB misses per read.
+*/
+
+void bench_tlb(size_t mb)
+{
+    size_t len = mb << 20;
+    size_t words = len / sizeof(uint64_t);
+    size_t mask = 1;
+    const long reads = 20000000;
+
+    while(mask * 2 <= words)
+        mask *= 2;
+    mask--;
+
+    int kinds[2] = { PAGES_NORMAL, huge_pages.get_mode() };
+    if(kinds[1] == PAGES_NORMAL)
+        kinds[1] = PAGES_THP;
+
+    std::cout << std::setprecision(2) << std::fixed;
+
+    for(int i = 0; i < 2; i++)
+    {
+        uint64_t *buf = (uint64_t *)huge_pages.allocate(len,kinds[i]);
+
+        memset(buf,0,len);
+
+#ifdef __linux__
+        long thp = thp_kbytes();
+        int fd = perf_dtlb_open();
+
+        if(fd >= 0)
+        {
+            ioctl(fd,PERF_EVENT_IOC_RESET,0);
+            ioctl(fd,PERF_EVENT_IOC_ENABLE,0);
+        }
+#endif
+
+        // Each address depends on the value read before, so reads cannot overlap
+
+        uint64_t idx = 1,start = now_ns();
+
+        for(long r = 0; r < reads; r++)
+            idx = (idx * 6364136223846793005ULL + 1442695040888963407ULL + buf[idx & mask]);
+
+        uint64_t elapsed = now_ns() - start;
+
+        int got = huge_pages.kind_of(buf);
+
+        std::cout << std::setw(6) << (got == PAGES_NORMAL ? "normal" : page_names[got]);
+        std::cout << " pages " << mb << "MB: " << (double)elapsed / reads << " ns/read";
+
+#ifdef __linux__
+        long long misses = 0;
+
+        if(fd >= 0 && read(fd,&misses,sizeof(misses)) == sizeof(misses))
+            std::cout << ", " << (double)misses * 1000.0 / reads << " dTLB misses per 1000 reads";
+        else
+            std::cout << ", dTLB counter not available";
+
+        if(fd >= 0)
+            close(fd);
+
+        if(thp >= 0)
+            std::cout << " (" << (thp >> 10) << "MB in THP)";
+#endif
+        std::cout << (idx == 42 ? " " : "") << std::endl;
+
+        huge_pages.release(buf,len);
+    }
+}
+
+/*
+    Dividend yield and P/E ratio of a universe of n stocks with random
+    figures (some zero), row by row and in one bulk pass.
+*/
+
+void bench_metrics(size_t n)
+{
+    stock_metrics m;
+    const int rounds = 100;
+
+    m.resize(n);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        m.price[i] = (rand() % 50) ? 0.41 + (rand() % 299) / 100.0 : 0.0;
+        m.last_dividend[i] = (rand() % 4) ? (rand() % 30) / 100.0 : 0.0;
+        m.yield_dividend[i] = (rand() % 10) ? m.last_dividend[i] : 2.0;
+    }
+
+    uint64_t start = now_ns();
+
+    for(int r = 0; r < rounds; r++)
+        for(size_t i = 0; i < n; i++)
+            m.update(i);
+
+    uint64_t rows = now_ns() - start;
+    double check = m.yield[n / 2] + m.pe[n / 2];
+
+    start = now_ns();
+
+    for(int r = 0; r < rounds; r++)
+        m.evaluate();
+
+    uint64_t bulk = now_ns() - start;
+
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << n << " stocks: row by row " << rows / rounds / 1000.0 << " us, bulk ";
+    std::cout << bulk / rounds / 1000.0 << " us";
+#if defined(__AVX__)
+    std::cout << " (AVX)";
+#elif defined(__SSE2__)
+    std::cout << " (SSE2)";
+#endif
+    std::cout << ((check == m.yield[n / 2] + m.pe[n / 2]) ? "" : " MISMATCH") << std::endl;
+}
+
+/*
+    Screens over n synthetic stocks: a three predicate scan of the ratio
+    columns, and a selective volume screen by full scan and by index.
+*/
+
+void bench_screen(size_t n)
+{
+    stock_metrics m;
+    screener s;
+    const int rounds = 100;
+    std::vector<predicate> scan(3),top(1);
+    std::vector<uint32_t> rows,indexed;
+
+    m.resize(n);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        m.price[i] = 0.41 + (rand() % 299) / 100.0;
+        m.last_dividend[i] = (rand() % 4) ? (rand() % 30) / 100.0 : 0.0;
+        m.yield_dividend[i] = m.last_dividend[i];
+        m.add_volume(i,rand() % 100000);
+    }
+
+    m.evaluate();
+
+    screener::parse("yield>0.05",scan[0]);
+    screener::parse("pe<15",scan[1]);
+    screener::parse("price>=1",scan[2]);
+    screener::parse("volume>=99000",top[0]);
+
+    uint64_t start = now_ns();
+
+    for(int r = 0; r < rounds; r++)
+        s.screen(m,scan,rows);
+
+    uint64_t scanned = now_ns() - start;
+    size_t matched = rows.size();
+
+    start = now_ns();
+
+    for(int r = 0; r < rounds; r++)
+        s.screen(m,top,rows);
+
+    uint64_t full = now_ns() - start;
+
+    // The first indexed screen builds the index, keep it out of the timing
+
+    s.set_index(FIELD_VOLUME,true);
+    s.screen(m,top,indexed);
+
+    start = now_ns();
+
+    for(int r = 0; r < rounds; r++)
+        s.screen(m,top,indexed);
+
+    uint64_t by_index = now_ns() - start;
+
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << n << " stocks: three predicate scan " << scanned / rounds / 1000.0 << " us (" << matched << " found), ";
+    std::cout << "volume screen " << full / rounds / 1000.0 << " us scanned, " << by_index / rounds / 1000.0 << " us indexed (";
+    std::cout << indexed.size() << " found)" << ((rows == indexed) ? "" : " MISMATCH") << std::endl;
+}
+
+/*
+    Price updates against n registered alerts: random walks of the
+    sample stocks, each step checked as the index would.
+*/
+
+void bench_alerts(size_t n)
+{
+    alert_book book(true);
+    std::vector<ticker> symbols = gbce.symbols();
+    std::vector<double> price(symbols.size(),1.5);
+    const long updates = 1000000;
+
+    for(size_t i = 0; i < n; i++)
+        book.add(symbols[rand() % symbols.size()],rand() % 2,0.41 + (rand() % 2990) / 1000.0,0.0);
+
+    uint64_t start = now_ns();
+
+    for(long u = 0; u < updates; u++)
+    {
+        size_t s = u % symbols.size();
+        double after = price[s] + ((rand() % 21) - 10) / 1000.0;
+
+        if(after < 0.41 || after > 3.4)
+            after = price[s];
+
+        book.check(symbols[s],price[s],after);
+        price[s] = after;
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    std::cout << std::setprecision(2) << std::fixed;
+    std::cout << n << " alerts: " << (double)elapsed / updates << " ns per price update, ";
+    std::cout << (double)book.get_notified() / updates << " notifications per update" << std::endl;
+}
+
+/*
+    Running totals updated by 'threads' writers at once, 'updates' each,
+    over 'symbols' distinct symbols, half of the trades going to the
+    first four (the hot ones): on the lock free tape, on the tape through
+    each writer's own accumulator, and on a hash map behind one mutex,
+    the way per-symbol state is kept today.
+*/
+
+struct locked_totals
+{
+    uint64_t    trades;
+    uint64_t    volume;
+    double      notional;
+    double      last;
+};
+
+void bench_tape(int threads,size_t symbols)
+{
+    const long updates = 2000000;
+    std::vector<ticker> names;
+
+    symbols = std::min(symbols,(size_t)TAPE_SLOTS / 2);
+
+    for(size_t i = 0; i < symbols; i++)
+    {
+        char code[TICKER_LEN + 1];
+
+        snprintf(code,sizeof(code),"S%06u",(unsigned)(i % 1000000));
+        names.push_back(ticker(code));
+    }
+
+    std::cout << std::setprecision(2) << std::fixed;
+
+    const char *kinds[] = { "lock free  ", "per thread ", "mutex map  " };
+
+    for(int kind = 0; kind < 3; kind++)
+    {
+        live_tape *lockfree = new live_tape;
+        std::unordered_map<uint64_t,locked_totals> locked;
+        std::mutex guard;
+        std::vector<std::thread> workers;
+        uint64_t start = now_ns();
+
+        for(int t = 0; t < threads; t++)
+        {
+            workers.push_back(std::thread([&,t]()
+            {
+                uint64_t x = 0x9e3779b97f4a7c15ULL * (t + 1);
+                tape_accumulator local(*lockfree);
+
+                for(long u = 0; u < updates; u++)
+                {
+                    x ^= x >> 12;
+                    x ^= x << 25;
+                    x ^= x >> 27;
+
+                    uint64_t pick = x * 0x2545f4914f6cdd1dULL >> 32;
+                    const ticker &sym = names[(pick & 1) ? (pick >> 1) % names.size() : (pick >> 1) % std::min((size_t)4,names.size())];
+                    uint32_t q = 1 + (x & 127);
+                    double price = 0.41 + (x >> 40 & 255) / 100.0;
+
+                    if(kind == 0)
+                        lockfree->update(sym,q,price);
+                    else if(kind == 1)
+                        local.update(sym,q,price);
+                    else
+                    {
+                        std::lock_guard<std::mutex> hold(guard);
+                        locked_totals &e = locked[sym.value()];
+
+                        e.trades++;
+                        e.volume += q;
+                        e.notional += q * price;
+                        e.last = price;
+                    }
+                }
+            }));
+        }
+
+        for(size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+
+        uint64_t elapsed = now_ns() - start;
+        uint64_t total = 0;
+
+        if(kind < 2)
+        {
+            for(size_t i = 0; i < names.size(); i++)
+            {
+                uint64_t trades,volume;
+                double notional,last;
+
+                if(lockfree->totals(names[i],trades,volume,notional,last))
+                    total += trades;
+            }
+        }
+        else
+        {
+            for(std::unordered_map<uint64_t,locked_totals>::iterator e = locked.begin(); e != locked.end(); e++)
+                total += e->second.trades;
+        }
+
+        std::cout << kinds[kind] << threads << " writers, " << symbols << " symbols: ";
+        std::cout << (double)elapsed / updates << " ns per update per writer, ";
+        std::cout << total * 1000.0 / elapsed << " M updates/s";
+        std::cout << ((total == (uint64_t)threads * updates) ? "" : " LOST UPDATES") << std::endl;
+
+        delete lockfree;
+    }
+}
+
+/*
+    Bulk text trades, in the archive's format:
+
+        stamp,symbol,account,BUY|SELL,quantity,price
+
+    The scanner finds the commas and newlines of 64 bytes at a time as a
+    bit mask (with AVX2 or SSE2 compares when built with them) and walks
+    the set bits, so the bytes between delimiters are never looked at
+    one by one to find them. Fields are then parsed in place, up to 8
+    characters at a time as one word: digits with a few multiplies, and
+    symbols straight into a ticker's code. A price of up to 15 digits is
+    its digits as an integer divided by a power of ten, which rounds
+    exactly as strtod() does.
+*/
+
+#define TEXT_FIELDS     6
+
+// Bit i set where p[i] is a comma or a newline
+
+template<bool VECTOR> inline uint64_t text_delimiters(const char *p)
+{
+#if defined(__AVX2__)
+    if(VECTOR)
+    {
+        const __m256i comma = _mm256_set1_epi8(','),newline = _mm256_set1_epi8('\n');
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+        uint32_t lo = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(a,comma),_mm256_cmpeq_epi8(a,newline)));
+        uint32_t hi = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(b,comma),_mm256_cmpeq_epi8(b,newline)));
+
+        return lo | (uint64_t)hi << 32;
+    }
+#elif defined(__SSE2__)
+    if(VECTOR)
+    {
+        const __m128i comma = _mm_set1_epi8(','),newline = _mm_set1_epi8('\n');
+        uint64_t m = 0;
+
+        for(int i = 0; i < 4; i++)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v,comma),_mm_cmpeq_epi8(v,newline))) << (16 * i);
+        }
+
+        return m;
+    }
+#endif
+
+    uint64_t m = 0;
+
+    for(int i = 0; i < 64; i++)
+        m |= (uint64_t)(p[i] == ',' || p[i] == '\n') << i;
+
+    return m;
+}
+
+// Up to 8 digits as a number. Where 8 bytes can be read they are taken
+// as one word, shifted so the digits end it and padded with leading
+// '0's, then checked and combined with a few multiplies (SWAR).
+
+inline bool text_digits(const char *p,size_t n,const char *limit,uint64_t &v)
+{
+    if(n > 8)
+        return false;
+
+    if(!n || limit - p < 8)
+    {
+        v = 0;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            unsigned d = (unsigned char)p[i] - '0';
+
+            if(d > 9)
+                return false;
+            v = v * 10 + d;
+        }
+
+        return true;
+    }
+
+    uint64_t w;
+
+    memcpy(&w,p,sizeof(w));
+
+    if(n < 8)
+        w = (w << (8 * (8 - n))) | (0x3030303030303030ULL >> (8 * n));
+
+    if(((w & 0xf0f0f0f0f0f0f0f0ULL) | (((w + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) != 0x3333333333333333ULL)
+        return false;
+
+    w -= 0x3030303030303030ULL;
+    w = (w * 10) + (w >> 8);
+    v = (((w & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+         (((w >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+
+    return true;
+}
+
+inline bool text_uint(const char *p,const char *end,const char *limit,uint64_t &v)
+{
+    size_t n = end - p;
+    uint64_t hi,lo;
+
+    if(!n || n > 16)
+        return false;
+
+    if(n <= 8)
+        return text_digits(p,n,limit,v);
+
+    if(!text_digits(p,n - 8,limit,hi) || !text_digits(end - 8,8,limit,lo))
+        return false;
+
+    v = hi * 100000000ULL + lo;
+
+    return true;
+}
+
+inline bool text_decimal(const char *p,const char *end,const char *limit,double &v)
+{
+    static const double scale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
+    static const uint64_t power[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+    const char *dot = p;
+    uint64_t whole = 0,part = 0;
+
+    while(dot < end && *dot != '.')
+        dot++;
+
+    if(dot == end)
+        dot = NULL;
+
+    size_t places = dot ? end - dot - 1 : 0;
+
+    if(!dot)
+        return text_uint(p,end,limit,whole) && (v = (double)whole,true);
+
+    if((dot == p && !places) || places > 8 || (dot - p) + places > 15 ||
+       (dot > p && !text_uint(p,dot,limit,whole)) || !text_digits(dot + 1,places,limit,part))
+        return false;
+
+    v = (double)(whole * power[places] + part) / scale[places];
+
+    return true;
+}
+
+// A ticker from the characters of a field
+
+inline bool text_ticker(const char *p,const char *end,const char *limit,ticker &t)
+{
+    size_t n = end - p;
+
+    if(n > TICKER_LEN)
+        return false;
+
+    if(!n || limit - p < 8)
+    {
+        t = ticker(p,n);
+        return true;
+    }
+
+    uint64_t w,pad = (n == 8) ? 0 : ~0ULL >> (8 * n);
+
+    memcpy(&w,p,sizeof(w));
+    w = byte_swap64(w);
+
+    // A NUL ends a ticker, as it does for ticker(const char *,size_t)
+
+    uint64_t v = w | pad;
+
+    if((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL)
+        t = ticker(p,n);
+    else
+        t = ticker::from_value(w & ~pad);
+
+    return true;
+}
+
+// One line's fields into a trade, false if it is not one
+
+inline bool text_trade(const char *const *f,const char *const *e,const char *limit,trade_op &op)
+{
+    uint64_t stamp,quantity;
+    double price;
+    ticker symbol,account;
+    const char *last = (e[5] > f[5] && e[5][-1] == '\r') ? e[5] - 1 : e[5];     // CRLF lines
+
+    if(!text_uint(f[0],e[0],limit,stamp) || !text_uint(f[4],e[4],limit,quantity) || !quantity ||
+       quantity > 0x7fffffff || !text_decimal(f[5],last,limit,price) || price <= 0.0 ||
+       !text_ticker(f[1],e[1],limit,symbol) || symbol.empty() || !text_ticker(f[2],e[2],limit,account) ||
+       e[3] == f[3] || (*f[3] != 'B' && *f[3] != 'S'))
+        return false;
+
+    op = trade_op(symbol,(*f[3] == 'B') ? BUY_STOCK : SELL_STOCK,(int)quantity,price,(time_t)stamp,account);
+
+    return true;
+}
+
+// Parse a buffer of lines into trades, counting the lines that are not
+// (a header among them). A last line without a newline counts too.
+
+template<bool VECTOR> size_t parse_text_trades(const char *buf,size_t len,std::vector<trade_op> &out,size_t &rejected)
+{
+    const char *field[TEXT_FIELDS + 1],*end[TEXT_FIELDS + 1];
+    size_t n = 0,before = out.size();
+    char tail[64];
+    trade_op op(ticker(),BUY_STOCK,0,0.0,(time_t)0);
+
+    rejected = 0;
+    field[0] = buf;
+
+    for(size_t at = 0; at < len; at += 64)
+    {
+        const char *block = buf + at;
+
+        // The last partial block is scanned from a padded copy
+
+        if(len - at < 64)
+        {
+            memset(tail,0,sizeof(tail));
+            memcpy(tail,block,len - at);
+            block = tail;
+        }
+
+        for(uint64_t m = text_delimiters<VECTOR>(block); m; m &= m - 1)
+        {
+            size_t pos = at + lowest_bit(m);
+
+            if(n < TEXT_FIELDS)
+                end[n] = buf + pos;
+            n++;
+
+            if(buf[pos] == '\n')
+            {
+                if(n == TEXT_FIELDS && text_trade(field,end,buf + len,op))
+                    out.push_back(op);
+                else if(n > 1 || end[0] != field[0])
+                    rejected++;
+
+                n = 0;
+            }
+
+            if(n < TEXT_FIELDS)
+                field[n] = buf + pos + 1;
+        }
+    }
+
+    // A last line without a newline
+
+    if(len && buf[len - 1] != '\n')
+    {
+        if(n < TEXT_FIELDS)
+            end[n] = buf + len;
+
+        if(++n == TEXT_FIELDS && text_trade(field,end,buf + len,op))
+            out.push_back(op);
+        else
+            rejected++;
+    }
+
+    return out.size() - before;
+}
+
+// A whole file's trades. False if it cannot be read.
+
+bool read_text_trades(const std::string &file,std::vector<trade_op> &out,size_t &rejected,size_t &bytes,uint64_t &parse_ns)
+{
+    std::ifstream in(file.c_str(),std::ios::binary);
+
+    if(!in)
+        return false;
+
+    std::vector<char> buf((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+
+    bytes = buf.size();
+    out.reserve(out.size() + bytes / 32);
+
+    uint64_t start = now_ns();
+
+    if(!buf.empty())
+        parse_text_trades<true>(&buf[0],buf.size(),out,rejected);
+    else
+        rejected = 0;
+
+    parse_ns = now_ns() - start;
+
+    return true;
+}
+
+/*
+    Text trade parsing speed over 'mb' megabytes of random trades: split
+    with istringstream as commands are, byte by byte with the same number
+    parsers, and with the vector scanner.
+*/
+
+void bench_parse(size_t mb)
+{
+    std::string text;
+    std::vector<ticker> symbols = gbce.symbols();
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+    while(text.size() < (mb << 20))
+    {
+        char line[96];
+
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+
+        char sym[TICKER_LEN + 1];
+        symbols[x % symbols.size()].c_str(sym);
+
+        snprintf(line,sizeof(line),"%llu,%s,AC%03u,%s,%u,%u.%02u\n",1700000000ULL + (unsigned long long)(text.size() >> 10),sym,
+                 (unsigned)(x >> 20) % 1000,(x & 1) ? "BUY" : "SELL",1 + (unsigned)(x >> 8) % 10000,(unsigned)(x >> 32) % 5,1 + (unsigned)(x >> 40) % 99);
+        text += line;
+    }
+
+    std::vector<trade_op> out;
+    double sums[3] = { 0.0, 0.0, 0.0 };
+    const char *names[3] = { "istringstream", "scalar scan  ", "vector scan  " };
+
+    out.reserve(text.size() / 24);
+
+    std::cout << std::setprecision(2) << std::fixed;
+
+    for(int kind = 0; kind < 3; kind++)
+    {
+        size_t rejected = 0;
+        uint64_t start = now_ns();
+
+        out.clear();
+
+        if(kind == 0)
+        {
+            std::istringstream lines(text);
+            std::string line;
+
+            while(getline(lines,line))
+            {
+                std::istringstream f(line);
+                std::vector<std::string> w;
+                std::string s;
+
+                while(getline(f,s,','))
+                    w.push_back(s);
+
+                double price = (w.size() == TEXT_FIELDS) ? atof(w[5].c_str()) : 0.0;
+
+                if(w.size() != TEXT_FIELDS || !std::isfinite(price))
+                {
+                    rejected++;
+                    continue;
+                }
+
+                out.push_back(trade_op(ticker(w[1]),w[3][0] == 'B' ? BUY_STOCK : SELL_STOCK,atoi(w[4].c_str()),
+                                       price,(time_t)atoll(w[0].c_str()),ticker(w[2])));
+            }
+        }
+        else if(kind == 1)
+            parse_text_trades<false>(text.data(),text.size(),out,rejected);
+        else
+            parse_text_trades<true>(text.data(),text.size(),out,rejected);
+
+        uint64_t elapsed = now_ns() - start;
+
+        for(size_t i = 0; i < out.size(); i++)
+            sums[kind] += out[i].quantity * out[i].price + out[i].stamp;
+
+        std::cout << names[kind] << " " << out.size() << " trades from " << mb << "MB: ";
+        std::cout << (double)text.size() / elapsed << " GB/s, " << (double)elapsed / out.size() << " ns per trade";
+        std::cout << ((kind && sums[kind] != sums[0]) || rejected ? " MISMATCH" : "") << std::endl;
+    }
+
+#if defined(__AVX2__)
+    std::cout << "(vector scan with AVX2)" << std::endl;
+#elif defined(__SSE2__)
+    std::cout << "(vector scan with SSE2)" << std::endl;
+#endif
+}
+
+/*
+    Command journal. Every command processed is recorded as its words,
+    when it started (wall clock), how long it took, and a hash and size
+    of what it printed, as compact binary records. Records are appended
+    to a buffer of the thread running the command and whole buffers go
+    to the persistence thread to be written, so a command pays for a
+    copy into memory. "journal dump" and "journal profile" decode a
+    journal file.
+*/
+
+#define JOURNAL_MAGIC   0x314a5353      // "SSJ1"
+#define JOURNAL_VERSION 3
+#define JOURNAL_CHUNK   (64 * 1024)     // Buffered per thread before handing over
+
+#define JOURNAL_QUIT    1               // The command ended the session
+
+#pragma pack(push,1)
+
+struct journal_header
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    reserved;
+    int64_t     started;        // Wall clock, nanoseconds since the epoch
+};
+
+struct journal_record
+{
+    uint32_t    length;         // Of the record with its words
+    uint16_t    words;          // Each a uint16_t length and its characters
+    uint8_t     flags;
+    uint8_t     reserved;
+    int64_t     start;          // Wall clock, nanoseconds since the epoch
+    uint64_t    duration;       // Nanoseconds
+    uint64_t    output_hash;    // FNV-1a of the output
+    uint32_t    output_bytes;
+    int64_t     clock;          // The engine clock the command ran at
+    uint64_t    seed;           // The engine generator's state before it
+    uint32_t    format;         // std::cout's format flags when it began
+    uint16_t    precision;      // and its precision
+    uint8_t     fill;           // and fill character
+    uint8_t     spare;
+};
+
+#pragma pack(pop)
+
+// Wall clock, nanoseconds since the epoch
+
+inline int64_t wall_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// What one thread prints while capturing, hashed on its way to 'to'
+// (the console when NULL). Captures nest: an enclosing one hashes the
+// output too. Other threads' output (eg. alerts fired by the feed)
+// goes straight to the console.
+
+class output_capture
+{
+    private:
+
+        output_capture *outer;
+        bool        active;
+
+    public:
+
+        uint64_t    hash;
+        uint64_t    bytes;
+        std::streambuf *to;
+
+        output_capture() : outer(NULL), active(false), hash(0xcbf29ce484222325ULL), bytes(0), to(NULL)
+        {
+        }
+
+        ~output_capture()
+        {
+            release();
+        }
+
+        void capture(std::streambuf *t = NULL);
+        void release();
+
+        void add(const char *s,std::streamsize n)
+        {
+            for(output_capture *c = this; c; c = c->outer)
+            {
+                for(std::streamsize i = 0; i < n; i++)
+                    c->hash = (c->hash ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+                c->bytes += n;
+            }
+        }
+};
+
+thread_local output_capture *capturing = NULL;
+
+void output_capture::capture(std::streambuf *t)
+{
+    if(active)
+        return;
+
+    outer = capturing;
+    to = t ? t : (outer ? outer->to : NULL);
+    active = true;
+    capturing = this;
+}
+
+void output_capture::release()
+{
+    if(!active)
+        return;
+
+    capturing = outer;
+    active = false;
+}
+
+// Sits under std::cout for the whole run, so threads never race on
+// swapping its buffer: output goes to the console or the calling
+// thread's capture.
+
+class console_output : public std::streambuf
+{
+    private:
+
+        std::streambuf *next;
+
+        std::streambuf *target(output_capture *c)
+        {
+            return (c && c->to) ? c->to : next;
+        }
+
+    protected:
+
+        int overflow(int c)
+        {
+            output_capture *cap = capturing;
+
+            if(c == EOF)
+                return target(cap)->pubsync() ? EOF : 0;
+
+            char ch = (char)c;
+
+            if(cap)
+                cap->add(&ch,1);
+
+            return target(cap)->sputc(ch);
+        }
+
+        std::streamsize xsputn(const char *s,std::streamsize n)
+        {
+            output_capture *cap = capturing;
+
+            if(cap)
+                cap->add(s,n);
+
+            return target(cap)->sputn(s,n);
+        }
+
+        int sync()
+        {
+            return target(capturing)->pubsync();
+        }
+
+    public:
+
+        console_output() : next(NULL)
+        {
+        }
+
+        void attach(std::ostream &os)
+        {
+            next = os.rdbuf(this);
+        }
+
+        void detach(std::ostream &os)
+        {
+            os.flush();
+            os.rdbuf(next);
+        }
+};
+
+console_output console;
+
+// Discards what is written to it, for output that is only hashed
+
+class null_output : public std::streambuf
+{
+    protected:
+
+        int overflow(int c)
+        {
+            return (c == EOF) ? 0 : c;
+        }
+
+        std::streamsize xsputn(const char *,std::streamsize n)
+        {
+            return n;
+        }
+};
+
+class command_journal
+{
+    private:
+
+        std::mutex  lock;
+        std::condition_variable work;
+        std::vector<std::vector<char> > pending;
+        std::thread writer;
+        std::ofstream out;
+        std::string path;
+        bool        stopping;
+        std::atomic<bool> on;
+
+        uint64_t    records;
+        uint64_t    written;            // Bytes
+
+        void run()
+        {
+            topology.join(ROLE_PERSISTENCE,"journal writer");
+
+            std::unique_lock<std::mutex> guard(lock);
+
+            for(;;)
+            {
+                while(pending.empty() && !stopping)
+                    work.wait(guard);
+
+                if(pending.empty())
+                    break;
+
+                std::vector<std::vector<char> > batch;
+
+                batch.swap(pending);
+                guard.unlock();
+
+                for(size_t i = 0; i < batch.size(); i++)
+                    out.write(&batch[i][0],batch[i].size());
+
+                out.flush();
+
+                guard.lock();
+
+                for(size_t i = 0; i < batch.size(); i++)
+                    written += batch[i].size();
+            }
+
+            guard.unlock();
+            topology.leave();
+        }
+
+    public:
+
+        command_journal() : stopping(false), on(false), records(0), written(0)
+        {
+        }
+
+        // By now thread locals may be gone, so only what was handed over
+        // gets written. main() stops the journal before returning.
+
+        ~command_journal()
+        {
+            finish();
+        }
+
+        bool active() const
+        {
+            return on.load(std::memory_order_relaxed);
+        }
+
+        bool start(const std::string &file)
+        {
+            if(on)
+                return false;
+
+            out.open(file.c_str(),std::ios::binary | std::ios::trunc);
+
+            if(!out)
+                return false;
+
+            journal_header h;
+
+            h.magic = JOURNAL_MAGIC;
+            h.version = JOURNAL_VERSION;
+            h.reserved = 0;
+            h.started = wall_ns();
+            out.write((const char *)&h,sizeof(h));
+
+            path = file;
+            stopping = false;
+            records = 0;
+            written = sizeof(h);
+            on = true;
+            writer = std::thread(&command_journal::run,this);
+
+            return true;
+        }
+
+        // Hand over a thread's buffer to be written
+
+        void submit(std::vector<char> &buf)
+        {
+            if(buf.empty())
+                return;
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                if(!stopping && on)
+                {
+                    pending.push_back(std::vector<char>());
+                    pending.back().swap(buf);
+                }
+            }
+
+            buf.clear();
+            work.notify_one();
+        }
+
+        void append(std::vector<char> &buf,const journal_record &r,const std::vector<std::string> &words)
+        {
+            size_t at = buf.size();
+
+            buf.resize(at + r.length);
+            memcpy(&buf[at],&r,sizeof(r));
+            at += sizeof(r);
+
+            for(size_t i = 0; i < words.size(); i++)
+            {
+                uint16_t n = (uint16_t)std::min(words[i].size(),(size_t)0xffff);
+
+                memcpy(&buf[at],&n,sizeof(n));
+                memcpy(&buf[at + sizeof(n)],words[i].data(),n);
+                at += sizeof(n) + n;
+            }
+
+            records++;
+        }
+
+        // Write what was handed over and close the file
+
+        void finish()
+        {
+            if(!on)
+                return;
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+                on = false;
+            }
+
+            work.notify_one();
+            writer.join();
+            out.close();
+        }
+
+        // Write what the calling thread buffered and finish. Other
+        // threads' buffers are written when they hand them over.
+
+        void stop();
+
+        void show()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            if(on)
+                std::cout << "Journaling to " << path << ", ";
+            else
+                std::cout << "Not journaling, ";
+
+            std::cout << records << " commands recorded, " << written << " bytes written" << std::endl;
+        }
+};
+
+command_journal journal;
+startup_mark startup_globals("other globals");
+
+// Each thread's records waiting to be handed over, handed over when the
+// thread ends if not before
+
+struct journal_buffer
+{
+    std::vector<char> data;
+
+    ~journal_buffer()
+    {
+        journal.submit(data);
+    }
+};
+
+thread_local journal_buffer journal_local;
+
+void command_journal::stop()
+{
+    if(!on)
+        return;
+
+    submit(journal_local.data);
+    finish();
+}
+
+// The clock and generator state the next command runs at, when replaying
+
+struct replay_point
+{
+    bool        set;
+    time_t      clock;
+    uint64_t    seed;
+};
+
+replay_point replay_next = { false, 0, 0 };
+
+// Journals one command: hashes what it prints while alive, and records
+// it when it goes out of scope
+
+class command_record
+{
+    private:
+
+        const std::vector<std::string> &words;
+        bool        recording;
+        int64_t     start;
+        uint64_t    start_ns;
+        output_capture tee;
+        time_t      clock;
+        time_t      outer;          // The clock held by an enclosing command
+        uint64_t    seed;
+        std::ios::fmtflags format;  // The output's format as the command found it
+        std::streamsize precision;
+        char        fill;
+
+    public:
+
+        uint8_t     flags;
+
+        command_record(const std::vector<std::string> &w) : words(w), recording(journal.active()),
+                                                           start(0), start_ns(0), flags(0)
+        {
+            if(replay_next.set)
+            {
+                clock = replay_next.clock;
+                engine_rng.set_state(replay_next.seed);
+                replay_next.set = false;
+            }
+            else
+                clock = time(NULL);
+
+            seed = engine_rng.get_state();
+            outer = engine_time.hold(clock);
+
+            if(!recording)
+                return;
+
+            start = wall_ns();
+            start_ns = now_ns();
+            format = std::cout.flags();
+            precision = std::cout.precision();
+            fill = std::cout.fill();
+            tee.capture();
+        }
+
+        ~command_record()
+        {
+            engine_time.release(outer);
+
+            if(!recording)
+                return;
+
+            std::cout.flush();
+            tee.release();
+
+            if(!journal.active())
+                return;
+
+            journal_record r;
+
+            r.length = sizeof(r);
+            for(size_t i = 0; i < words.size(); i++)
+                r.length += sizeof(uint16_t) + std::min(words[i].size(),(size_t)0xffff);
+
+            r.words = (uint16_t)words.size();
+            r.flags = flags;
+            r.reserved = 0;
+            r.start = start;
+            r.duration = now_ns() - start_ns;
+            r.output_hash = tee.hash;
+            r.output_bytes = (uint32_t)tee.bytes;
+            r.clock = clock;
+            r.seed = seed;
+            r.format = (uint32_t)format;
+            r.precision = (uint16_t)precision;
+            r.fill = (uint8_t)fill;
+            r.spare = 0;
+
+            journal.append(journal_local.data,r,words);
+
+            if(journal_local.data.size() >= JOURNAL_CHUNK)
+                journal.submit(journal_local.data);
+        }
+};
+
+// A journal file's records, with their words. False if it is not one.
+
+struct journal_entry
+{
+    journal_record r;
+    std::vector<std::string> words;
+};
+
+bool read_journal(const std::string &file,journal_header &h,std::vector<journal_entry> &entries)
+{
+    std::ifstream in(file.c_str(),std::ios::binary);
+
+    if(!in.read((char *)&h,sizeof(h)) || h.magic != JOURNAL_MAGIC || h.version != JOURNAL_VERSION)
+        return false;
+
+    journal_entry e;
+
+    while(in.read((char *)&e.r,sizeof(e.r)))
+    {
+        std::vector<char> rest(e.r.length - std::min((size_t)e.r.length,sizeof(e.r)));
+
+        if(e.r.length < sizeof(e.r) || (!rest.empty() && !in.read(&rest[0],rest.size())))
+            break;
+
+        e.words.clear();
+
+        for(size_t at = 0,i = 0; i < e.r.words && at + sizeof(uint16_t) <= rest.size(); i++)
+        {
+            uint16_t n;
+
+            memcpy(&n,&rest[at],sizeof(n));
+            at += sizeof(n);
+            e.words.push_back(std::string(&rest[at],std::min((size_t)n,rest.size() - at)));
+            at += n;
+        }
+
+        entries.push_back(e);
+    }
+
+    return true;
+}
+
+std::string join_words(const std::vector<std::string> &words)
+{
+    std::string s;
+
+    for(size_t i = 0; i < words.size(); i++)
+        s += (i ? " " : "") + words[i];
+
+    return s;
+}
+
+// Show the records of a journal, 'limit' at most
+
+bool dump_journal(const std::string &file,size_t limit)
+{
+    journal_header h;
+    std::vector<journal_entry> entries;
+
+    if(!read_journal(file,h,entries))
+        return false;
+
+    for(size_t i = 0; i < entries.size() && i < limit; i++)
+    {
+        const journal_record &r = entries[i].r;
+        time_t secs = r.start / 1000000000LL;
+        char at[32];
+
+        strftime(at,sizeof(at),"%Y-%m-%d %H:%M:%S",localtime(&secs));
+
+        std::cout << "#" << i + 1 << " " << at << "." << std::setw(6) << std::setfill('0') << r.start % 1000000000LL / 1000;
+        std::cout << std::setfill(' ') << std::setprecision(1) << std::fixed << std::setw(10) << r.duration / 1000.0 << " us ";
+        std::cout << std::hex << std::setw(16) << std::setfill('0') << r.output_hash << std::dec << std::setfill(' ');
+        std::cout << std::setw(7) << r.output_bytes << "B " << (r.flags & JOURNAL_QUIT ? "quit " : "");
+        std::cout << join_words(entries[i].words) << std::endl;
+    }
+
+    std::cout << entries.size() << " commands in " << file << std::endl;
+
+    return true;
+}
+
+// Time spent per command name in a journal
+
+bool profile_journal(const std::string &file)
+{
+    journal_header h;
+    std::vector<journal_entry> entries;
+    std::map<std::string,std::vector<uint64_t> > by_name;
+
+    if(!read_journal(file,h,entries))
+        return false;
+
+    for(size_t i = 0; i < entries.size(); i++)
+        by_name[entries[i].words.empty() ? "" : entries[i].words[0]].push_back(entries[i].r.duration);
+
+    std::cout << "command       count   total ms    mean us     p99 us     max us" << std::endl;
+    std::cout << std::setprecision(1) << std::fixed;
+
+    for(std::map<std::string,std::vector<uint64_t> >::iterator c = by_name.begin(); c != by_name.end(); c++)
+    {
+        std::vector<uint64_t> &d = c->second;
+        uint64_t total = 0;
+
+        std::sort(d.begin(),d.end());
+
+        for(size_t i = 0; i < d.size(); i++)
+            total += d[i];
+
+        std::cout << std::left << std::setw(10) << c->first << std::right << std::setw(8) << d.size();
+        std::cout << std::setprecision(3) << std::setw(11) << total / 1e6 << std::setprecision(1);
+        std::cout << std::setw(11) << total / 1e3 / d.size();
+        std::cout << std::setw(11) << d[std::min(d.size() - 1,(size_t)(0.99 * d.size()))] / 1e3;
+        std::cout << std::setw(11) << d.back() / 1e3 << std::endl;
+    }
+
+    return true;
+}
+
+bool process_command(std::string cmdline);
+
+/*
+    Run a journal's commands again, each at the clock and generator state
+    it was recorded with, and compare their output with the recording.
+    The engine must be in the state the recording started from, which in
+    practice means a fresh process. Commands that act outside the engine
+    (feeds, servers, the journal itself, benchmarks) are skipped.
+*/
+
+bool replay_journal(const std::string &file,size_t show)
+{
+    journal_header h;
+    std::vector<journal_entry> entries;
+    std::map<std::string,uint64_t> recorded, replayed;
+    std::map<std::string,size_t> counts;
+    size_t same = 0, differ = 0, skipped = 0;
+
+    if(!read_journal(file,h,entries))
+        return false;
+
+    if(trade_db.size())
+        std::cout << "WARNING: " << trade_db.size() << " trades already recorded, results will differ" << std::endl;
+
+    std::ios saved_format(NULL);
+    std::ios fresh(NULL);
+    null_output sink;
+
+    saved_format.copyfmt(std::cout);
+    std::cout.copyfmt(fresh);
+
+    std::ostringstream report;
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        const std::vector<std::string> &w = entries[i].words;
+        const journal_record &r = entries[i].r;
+        std::string name = w.empty() ? "" : w[0];
+        std::string sub = (w.size() > 1) ? w[1] : "";
+
+        if(r.flags & JOURNAL_QUIT || !name.compare("feed") || !name.compare("metrics") || !name.compare("bench") ||
+           (!name.compare("journal") && (!sub.compare("start") || !sub.compare("stop") || !sub.compare("replay"))))
+        {
+            skipped++;
+            continue;
+        }
+
+        output_capture out;
+
+        out.capture(&sink);
+
+        replay_next.clock = (time_t)r.clock;
+        replay_next.seed = r.seed;
+        replay_next.set = true;
+
+        // Commands print in whatever format the one before left behind
+
+        std::cout.flags((std::ios::fmtflags)r.format);
+        std::cout.precision(r.precision);
+        std::cout.fill((char)r.fill);
+
+        uint64_t start = now_ns();
+        process_command(join_words(w));
+        uint64_t took = now_ns() - start;
+
+        std::cout.flush();
+        out.release();
+
+        recorded[name] += r.duration;
+        replayed[name] += took;
+        counts[name]++;
+
+        if(out.hash == r.output_hash && out.bytes == r.output_bytes)
+            same++;
+        else if(differ++ < show)
+            report << "#" << i + 1 << " " << out.bytes << "B vs " << r.output_bytes << "B recorded: " << join_words(w) << std::endl;
+    }
+
+    std::cout.copyfmt(saved_format);
+
+    std::cout << "Replayed " << same + differ << " commands from " << file << ": " << same << " identical, ";
+    std::cout << differ << " different, " << skipped << " skipped" << std::endl;
+    std::cout << report.str();
+
+    std::cout << "command       count  recorded us  replayed us" << std::endl;
+    std::cout << std::setprecision(1) << std::fixed;
+
+    for(std::map<std::string,size_t>::iterator c = counts.begin(); c != counts.end(); c++)
+    {
+        std::cout << std::left << std::setw(10) << c->first << std::right << std::setw(8) << c->second;
+        std::cout << std::setw(13) << recorded[c->first] / 1e3 / c->second;
+        std::cout << std::setw(13) << replayed[c->first] / 1e3 / c->second << std::endl;
+    }
+
+    std::cout.copyfmt(saved_format);
+
+    return true;
+}
+
+/* A function to process commands to test the code */
+
+bool process_command(std::string cmdline)
+{
+    std::vector<std::string> cmd;
+    std::istringstream f(cmdline);
+    std::string s;
+
+    while (getline(f, s, ' '))
+        cmd.push_back(s);
+
+    std::unique_lock<std::mutex> lock(engine_lock);
+    command_record record(cmd);
+
+    bump(telemetry.commands);
+    session_tick(engine_time.now());
+
+    if(cmd.size() > 0)
+    {
+
+        if(!cmd[0].compare("quit"))
+        {
+            record.flags |= JOURNAL_QUIT;
+            return false;
+        }
+
+        if(!cmd[0].compare("help"))
+        {
+            std::cout << std::endl;
+            std::cout << "COMMANDS:" << std::endl << std::endl;
+            std::cout << "    help   - Show this help." << std::endl;
+            std::cout << "    index  - Show the list of stock and the All-share index." << std::endl;
+            std::cout << "    trade  - Add random trading." << std::endl;
+            std::cout << "    buy    - Buy stock. eg. buy 22 ALE 3.12 [account]" << std::endl;
+            std::cout << "    sell   - Sell stock. eg. sell 22 ALE 3.12 [account]" << std::endl;
+            std::cout << "    list   - Show trading database." << std::endl;
+            std::cout << "    price  - Recalculate price of stock based on the pricing window's trade (15m by default)" << std::endl;
+            std::cout << "             price <window> shows prices over another window. eg. price 5m" << std::endl;
+            std::cout << "             price compare shows every pricing method side by side" << std::endl;
+            std::cout << "    window - Show or set the windows kept. eg. window 1m 5m 15m 60m [price 15m], window price 5m" << std::endl;
+            std::cout << "    method - Show or set how prices are made: method vwap|twap|volume [shares]|last [trades]" << std::endl;
+            std::cout << "    yield  - Show the dividend yield of all stock" << std::endl;
             std::cout << "    pe     - Show the P/E Ratio of all stock" << std::endl;
+            std::cout << "    dividend - Announce a dividend. eg. dividend ALE 0.25 [fixed]" << std::endl;
+            std::cout << "    split  - Split stock. eg. split ALE 2 (two new shares per old one)" << std::endl;
+            std::cout << "    screen - Find stock. eg. screen yield>0.05 pe<15 volume>=100" << std::endl;
+            std::cout << "             (fields price yield pe dividend volume), screen index|drop <field>" << std::endl;
+            std::cout << "    alert  - Standing alerts. eg. alert ALE move 5, alert index below 1.2, alert GIN above 3" << std::endl;
+            std::cout << "             alert list, alert drop <id>" << std::endl;
+            std::cout << "    audit  - Price provenance. eg. audit on [depth], audit off, audit ALE [updates]" << std::endl;
+            std::cout << "    journal- Record commands. eg. journal start <file>, journal stop" << std::endl;
+            std::cout << "             journal dump <file> [n], journal profile <file>" << std::endl;
+            std::cout << "             journal replay <file> [n] (in a fresh process, shows n differences)" << std::endl;
+            std::cout << "    metrics- Prometheus endpoint on the loopback. eg. metrics start 9100, metrics stop, metrics dump" << std::endl;
+            std::cout << "    feed   - Market data feed. eg. feed start 7000 [group], feed stop, feed stats" << std::endl;
+            std::cout << "             feed wait spin|yield|block|adaptive" << std::endl;
+            std::cout << "             feed replay <port> <trades> [per-packet] [drop-every] [rate] [group]" << std::endl;
+            std::cout << "    profile- Today's volume at price. eg. profile ALE [levels], profile tick 0.05" << std::endl;
+            std::cout << "    quantiles - Trade size and price p50/p95/p99. eg. quantiles ALE, quantiles all" << std::endl;
+            std::cout << "    accounts - Distinct accounts and the top ones by volume. eg. accounts ALE [n], accounts all" << std::endl;
+            std::cout << "    tape   - Running totals per symbol, read without locking. eg. tape, tape ALE" << std::endl;
+            std::cout << "             tape cadence <trades> (how far a writer's own totals may lag, 1 writes through)" << std::endl;
+            std::cout << "    startup- Time taken by each phase of startup" << std::endl;
+            std::cout << "    ingest - Trades from a text file in the archive's format. eg. ingest trades-20240102.csv" << std::endl;
+            std::cout << "    universe - Stocks from a CSV (symbol,type,last dividend,fixed dividend,par value)" << std::endl;
+            std::cout << "             through a binary cache. eg. universe load stocks.csv, universe" << std::endl;
+            std::cout << "    session- Trading hours and end of day. eg. session hours 08:00 16:30, session off" << std::endl;
+            std::cout << "             session holiday [drop] 2026-12-25, session close, session bars, session archive <dir>" << std::endl;
+            std::cout << "    threads- Show or set the CPUs of a thread role. eg. threads ingestion 2,3" << std::endl;
+            std::cout << "             (roles: command ingestion pricing network persistence analytics, 'any' unpins)" << std::endl;
+            std::cout << "    hugepages - Back big tables by huge pages: hugepages off|thp|2mb|1gb" << std::endl;
+            std::cout << "    reserve- Prefault room for the day. eg. reserve 10000000 [window-trades] [lock]" << std::endl;
+            std::cout << "    bench  - Benchmarks. eg. bench tlb [MB], bench metrics [stocks], bench alerts [n]" << std::endl;
+            std::cout << "             bench tape [writers] [symbols], bench parse [MB]" << std::endl;
+            std::cout << "    stats  - Show engine statistics" << std::endl;
             std::cout << "    quit   - end the program\n" << std::endl;
+            std::cout << "Commands can also be given as arguments, eg. ssstock \"threads network 1\" \"feed start 7000\"" << std::endl;
+            std::cout << "to run them at startup before the prompt." << std::endl << std::endl;
+        }
+        else if(!cmd[0].compare("index"))
+        {
+            std::cout << std::setprecision(4) << std::fixed;
+            std::cout << std::endl << "GBCE Index " << gbce.get_index() << std::endl << std::endl;
+
+            gbce.show();
+
+            std::cout << std::endl;
+
+        }
+        else if((!cmd[0].compare("trade") || !cmd[0].compare("buy") || !cmd[0].compare("sell")) && !sessions.admit(engine_time.now()))
+        {
+            std::cout << "ERROR: Market closed" << std::endl;
+        }
+        else if(!cmd[0].compare("trade"))
+        {
+            gbce.random_trade("TEA");
+            gbce.random_trade("POP");
+            gbce.random_trade("ALE");
+            gbce.random_trade("GIN");
+            gbce.random_trade("JOE");
+
+            std::cout << "Done. " << trade_db.size() << " trading operations in the database" << std::endl;
+        }
+        else if(!cmd[0].compare("buy") || !cmd[0].compare("sell"))
+        {
+            if(cmd.size() > 3)
+            {
+                ticker symbol(cmd[2]);
+
+                if(!gbce.exist(symbol))
+                {
+                    std::cout << "ERROR: Unknown symbol " << cmd[2] << std::endl;
+                }
+                else
+                {
+                    int buy = cmd[0].compare("sell");
+                    int qty = atoi(cmd[1].c_str());
+                    double price = atof(cmd[3].c_str());
+                    ticker account = (cmd.size() > 4) ? ticker(cmd[4]) : ticker();
+
+                    if(cmd.size() > 4 && account.empty())
+                        std::cout << "ERROR: Bad account " << cmd[4] << std::endl;
+                    else if(gbce.trade(symbol,(buy) ? BUY_STOCK : SELL_STOCK,qty,price,account))
+                        std::cout << "Done. " << trade_db.size() << " Trading operations in the database" << std::endl;
+                    else
+                        std::cout << "ERROR: Cannot " << cmd[0] << " shares of " << cmd[2] << " at " << cmd[1] << std::endl;
+                }
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is '" << cmd[0] << " <quantity> <symbol> <price> [account]'" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("dividend"))
+        {
+            if(cmd.size() > 2)
+            {
+                ticker symbol(cmd[1]);
+                stock *st = gbce.find(symbol);
+
+                if(!st)
+                {
+                    std::cout << "ERROR: Unknown symbol " << cmd[1] << std::endl;
+                }
+                else
+                {
+                    // Keep the fixed dividend if not given
+
+                    double ld,fd = st->get_fixed_dividend();
+
+                    if(!parse_number(cmd[2],ld) || (cmd.size() > 3 && !parse_number(cmd[3],fd)))
+                        std::cout << "ERROR: syntax is 'dividend <symbol> <last> [fixed]'" << std::endl;
+                    else if(gbce.set_dividend(symbol,ld,fd))
+                    {
+                        std::cout << std::setprecision(2) << std::fixed;
+                        std::cout << "Done. " << symbol << " yield " << gbce.get_yield(st);
+                        std::cout << " P/E " << gbce.get_pe(st) << std::endl;
+                    }
+                    else
+                    {
+                        std::cout << "ERROR: Cannot set dividend of " << cmd[1] << std::endl;
+                    }
+                }
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'dividend <symbol> <last> [fixed]'" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("split"))
+        {
+            if(cmd.size() > 2)
+            {
+                ticker symbol(cmd[1]);
+                double ratio;
+
+                if(!parse_number(cmd[2],ratio))
+                    std::cout << "ERROR: syntax is 'split <symbol> <ratio>'" << std::endl;
+                else if(gbce.split(symbol,ratio))
+                {
+                    std::cout << std::setprecision(4) << std::fixed;
+                    std::cout << "Done. " << symbol << " split " << cmd[2] << " for 1, price ";
+                    std::cout << gbce.find(symbol)->get_price() << ", GBCE Index " << gbce.get_index() << std::endl;
+                }
+                else
+                {
+                    std::cout << "ERROR: Cannot split " << cmd[1] << " by " << cmd[2] << std::endl;
+                }
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'split <symbol> <ratio>'" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("screen"))
+        {
+            int f = (cmd.size() > 2) ? screener::field(cmd[2]) : -1;
+
+            if(cmd.size() > 1 && (!cmd[1].compare("index") || !cmd[1].compare("drop")))
+            {
+                if(f < 0)
+                {
+                    std::cout << "ERROR: syntax is 'screen index|drop price|yield|pe|dividend|volume'" << std::endl;
+                }
+                else
+                {
+                    screens.set_index(f,!cmd[1].compare("index"));
+                    std::cout << "Done. " << field_names[f] << (screens.has_index(f) ? " indexed" : " not indexed") << std::endl;
+                }
+            }
+            else if(cmd.size() > 1)
+            {
+                std::vector<predicate> preds(cmd.size() - 1);
+                size_t i = 0;
+
+                while(i < preds.size() && screener::parse(cmd[i + 1],preds[i]))
+                    i++;
+
+                if(i < preds.size())
+                {
+                    std::cout << "ERROR: Bad predicate " << cmd[i + 1] << " (eg. yield>0.05 pe<=15 volume>1000)" << std::endl;
+                }
+                else
+                {
+                    const stock_metrics &m = gbce.get_metrics();
+                    std::vector<uint32_t> rows;
+                    uint64_t start = now_ns();
+                    bool indexed = screens.screen(m,preds,rows);
+                    uint64_t elapsed = now_ns() - start;
+
+                    std::cout << std::setprecision(2) << std::fixed;
+                    std::cout << "Sym         Price    Yield      P/E   Volume" << std::endl;
+
+                    for(i = 0; i < rows.size() && i < 20; i++)
+                    {
+                        size_t r = rows[i];
+
+                        std::cout << std::left << std::setw(8) << gbce.symbol_at(r) << std::right;
+                        std::cout << std::setw(9) << m.price[r] << std::setw(9) << m.yield[r];
+                        std::cout << std::setw(9) << m.pe[r] << std::setprecision(0) << std::setw(9) << m.volume[r];
+                        std::cout << std::setprecision(2) << std::endl;
+                    }
+                    if(rows.size() > i)
+                        std::cout << "... and " << rows.size() - i << " more" << std::endl;
+
+                    std::cout << rows.size() << " of " << m.size() << " stocks match (";
+                    std::cout << (indexed ? "index" : "scan") << ", " << elapsed / 1000.0 << " us)" << std::endl;
+                }
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'screen <field><op><value> ...' or 'screen index|drop <field>'" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("alert"))
+        {
+            if(cmd.size() > 1 && !cmd[1].compare("list"))
+            {
+                alerts.show();
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("drop"))
+            {
+                if(alerts.drop(atol(cmd[2].c_str())))
+                    std::cout << "Done. Alert " << cmd[2] << " dropped" << std::endl;
+                else
+                    std::cout << "ERROR: No alert " << cmd[2] << std::endl;
+            }
+            else if(cmd.size() > 3)
+            {
+                bool index = !cmd[1].compare("index");
+                ticker symbol = index ? ticker() : ticker(cmd[1]);
+                stock *st = index ? NULL : gbce.find(symbol);
+                int kind = ALERT_ABOVE;
+                double value;
+
+                while(kind <= ALERT_MOVE && cmd[2].compare(alert_names[kind]))
+                    kind++;
+
+                if(!index && !st)
+                    std::cout << "ERROR: Unknown symbol " << cmd[1] << std::endl;
+                else if(kind > ALERT_MOVE || (index && kind == ALERT_MOVE))
+                    std::cout << "ERROR: Unknown alert " << cmd[2] << std::endl;
+                else
+                {
+                    uint32_t id = parse_number(cmd[3],value) ? alerts.add(symbol,kind,value,st ? st->get_par_value() : 0.0) : 0;
+
+                    if(id)
+                        std::cout << "Done. Alert " << id << " on " << cmd[1] << " " << cmd[2] << " " << cmd[3] << std::endl;
+                    else
+                        std::cout << "ERROR: syntax is 'alert <symbol>|index above|below <value>', 'alert <symbol> move <percent>'" << std::endl;
+                }
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'alert <symbol>|index above|below <value>', 'alert <symbol> move <percent>'";
+                std::cout << ", 'alert list' or 'alert drop <id>'" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("audit"))
+        {
+            if(cmd.size() > 1 && !cmd[1].compare("on"))
+            {
+                audit.enable((cmd.size() > 2) ? atol(cmd[2].c_str()) : 0);
+                std::cout << "Done. Recording where prices come from" << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("off"))
+            {
+                audit.disable();
+                std::cout << "Done. Not recording where prices come from" << std::endl;
+            }
+            else if(cmd.size() > 1 && gbce.exist(ticker(cmd[1])))
+            {
+                ticker symbol(cmd[1]);
+                std::vector<price_origin> h = audit.last(symbol,(cmd.size() > 2) ? atol(cmd[2].c_str()) : 10);
+
+                std::cout << std::setprecision(4) << std::fixed;
+
+                for(size_t i = 0; i < h.size(); i++)
+                {
+                    char at[16];
+                    double vwap;
+                    uint32_t found = gbce.replay_origin(symbol,h[i],vwap);
+                    time_t when = h[i].at;
+                    std::ostringstream basis;
+
+                    strftime(at,sizeof(at),"%H:%M:%S",localtime(&when));
+
+                    if(h[i].method == PRICE_VOLUME)
+                        basis << "a " << h[i].param << " share bucket";
+                    else if(h[i].method == PRICE_LAST)
+                        basis << "the last " << h[i].param << " trades";
+                    else
+                        basis << h[i].param << "s";
+
+                    std::cout << "[" << at << "] " << symbol << " " << h[i].price;
+
+                    if(!h[i].trades)
+                    {
+                        std::cout << " kept, no trades in " << basis.str() << std::endl;
+                        continue;
+                    }
+
+                    std::cout << " from " << h[i].trades << " trades #" << h[i].first_id << "-#";
+                    std::cout << h[i].first_id + h[i].span << " in " << basis.str() << " by " << method_names[h[i].method];
+
+                    // Check the record against trade_db
+
+                    if(found == h[i].trades && fabs(vwap - h[i].price) <= 1e-6 * fabs(vwap) + 1e-6)
+                        std::cout << ", verified" << std::endl;
+                    else
+                        std::cout << ", MISMATCH: " << found << " trades give " << vwap << std::endl;
+                }
+
+                std::cout << h.size() << " price updates shown" << std::endl;
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'audit on [depth]', 'audit off' or 'audit <symbol> [updates]'" << std::endl;
+            }
         }
-        else if(!cmd[0].compare("index"))
+        else if(!cmd[0].compare("list"))
         {
-            std::cout << std::setprecision(4) << std::fixed;
-            std::cout << std::endl << "GBCE Index " << gbce.get_index() << std::endl << std::endl;
+            gbce.list_trade();
+        }
+        else if(!cmd[0].compare("price"))
+        {
+            if(cmd.size() > 1 && !cmd[1].compare("compare"))
+            {
+                gbce.compare();
+            }
+            else if(cmd.size() > 1)
+            {
+                time_t secs = window_config::parse(cmd[1]);
 
-            gbce.show();
+                if(secs)
+                    gbce.price(secs);
+                else
+                    std::cout << "ERROR: Bad window " << cmd[1] << std::endl;
+            }
+            else
+                gbce.price();
+        }
+        else if(!cmd[0].compare("method"))
+        {
+            if(cmd.size() > 1)
+            {
+                if(gbce.set_method(window_config::method(cmd[1]),(cmd.size() > 2) ? atol(cmd[2].c_str()) : 0))
+                    std::cout << "Done. Prices are made by " << cmd[1] << " from the next update" << std::endl;
+                else
+                    std::cout << "ERROR: syntax is 'method vwap|twap|volume [shares]|last [trades]'" << std::endl;
+            }
+            else
+            {
+                std::cout << "Prices are made by " << method_names[gbce.get_method()] << ", windows ";
+                windows.show();
+            }
+        }
+        else if(!cmd[0].compare("window"))
+        {
+            if(cmd.size() > 2 && !cmd[1].compare("price"))
+            {
+                if(windows.set_pricing(window_config::parse(cmd[2])))
+                    std::cout << "Done. Prices come from the " << cmd[2] << " window" << std::endl;
+                else
+                    std::cout << "ERROR: " << cmd[2] << " is not a window kept" << std::endl;
+            }
+            else if(cmd.size() > 1)
+            {
+                std::vector<time_t> secs;
+                time_t pricing = 0;
+                bool ok = true;
 
-            std::cout << std::endl;
+                for(size_t i = 1; i < cmd.size() && ok; i++)
+                {
+                    if(!cmd[i].compare("price") && i + 1 < cmd.size())
+                        ok = (pricing = window_config::parse(cmd[++i])) != 0;
+                    else
+                    {
+                        secs.push_back(window_config::parse(cmd[i]));
+                        ok = secs.back() != 0;
+                    }
+                }
 
+                if(!ok || (pricing && std::find(secs.begin(),secs.end(),pricing) == secs.end()))
+                    std::cout << "ERROR: Bad windows" << std::endl;
+                else if(!gbce.set_windows(secs,pricing))
+                    std::cout << "ERROR: Up to " << MAX_WINDOWS << " windows of at most " << window_config::name(MAX_WINDOW_LEN) << std::endl;
+                else
+                {
+                    std::cout << "Done. Windows ";
+                    windows.show();
+                }
+            }
+            else
+                windows.show();
         }
-        else if(!cmd[0].compare("trade"))
+        else if(!cmd[0].compare("yield"))
         {
-            gbce.random_trade("TEA");
-            gbce.random_trade("POP");
-            gbce.random_trade("ALE");
-            gbce.random_trade("GIN");
-            gbce.random_trade("JOE");
+            gbce.dividend_yield();
+        }
+        else if(!cmd[0].compare("pe"))
+        {
+            gbce.pe_ratio();
+        }
+        else if(!cmd[0].compare("profile"))
+        {
+            if(cmd.size() > 2 && !cmd[1].compare("tick"))
+            {
+                double t = atof(cmd[2].c_str());
 
-            std::cout << "Done. " << trade_db.size() << " trading operations in the database" << std::endl;
+                if(t > 0)
+                {
+                    gbce.set_profile_tick(t);
+                    std::cout << "Done. Volume profiles by " << cmd[2] << std::endl;
+                }
+                else
+                    std::cout << "ERROR: Bad tick size " << cmd[2] << std::endl;
+            }
+            else if(cmd.size() < 2 || !gbce.show_profile(ticker(cmd[1]),(cmd.size() > 2) ? atol(cmd[2].c_str()) : 20))
+            {
+                std::cout << "ERROR: syntax is 'profile <symbol> [levels]' or 'profile tick <size>'" << std::endl;
+            }
         }
-        else if(!cmd[0].compare("buy") || !cmd[0].compare("sell"))
+        else if(!cmd[0].compare("quantiles"))
         {
-            if(cmd.size() > 3)
+            if(cmd.size() < 2 || !gbce.show_quantiles(cmd[1]))
+                std::cout << "ERROR: syntax is 'quantiles <symbol>|all'" << std::endl;
+        }
+        else if(!cmd[0].compare("accounts"))
+        {
+            if(cmd.size() < 2 || !gbce.show_accounts(cmd[1],(cmd.size() > 2) ? atol(cmd[2].c_str()) : 10))
+                std::cout << "ERROR: syntax is 'accounts <symbol>|all [n]'" << std::endl;
+        }
+        else if(!cmd[0].compare("ingest"))
+        {
+            std::vector<trade_op> trades;
+            size_t rejected = 0,bytes = 0,unknown = 0,refused = 0;
+            uint64_t parse_ns = 0;
+
+            // Parse without holding up the engine, then record in one go
+
+            lock.unlock();
+
+            if(cmd.size() < 2)
+                std::cout << "ERROR: syntax is 'ingest <file>'" << std::endl;
+            else if(!read_text_trades(cmd[1],trades,rejected,bytes,parse_ns))
+                std::cout << "ERROR: Cannot read " << cmd[1] << std::endl;
+            else
             {
-                if(!gbce.exist(cmd[2]))
+                uint64_t start = now_ns();
+
+                lock.lock();
+
+                time_t now = engine_time.now();
+
+                for(size_t i = 0; i < trades.size(); i++)
                 {
-                    std::cout << "ERROR: Unknown symbol " << cmd[2] << std::endl;
+                    if(!sessions.admit(now))
+                        refused++;
+                    else if(!gbce.record(trades[i]))
+                        unknown++;
                 }
+
+                uint64_t record_ns = now_ns() - start;
+
+                std::cout << "Done. " << trades.size() << " trades from " << cmd[1] << " (" << unknown << " of unknown stocks, ";
+                if(refused)
+                    std::cout << refused << " refused as the market is closed, ";
+                std::cout << rejected << " lines skipped), parsed at " << std::setprecision(2) << std::fixed;
+                std::cout << (parse_ns ? (double)bytes / parse_ns : 0.0) << " GB/s, recorded in " << record_ns / 1e6 << " ms" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("universe"))
+        {
+            if(cmd.size() > 2 && !cmd[1].compare("load"))
+            {
+                std::unique_ptr<reference_data> next(new reference_data);
+                std::string error;
+
+                if(!trade_db.empty())
+                    std::cout << "ERROR: The universe can only be replaced before any trade" << std::endl;
+                else if(!next->load(cmd[2],error))
+                    std::cout << "ERROR: " << error << std::endl;
                 else
                 {
-                    int buy = cmd[0].compare("sell");
-                    int qty = atoi(cmd[1].c_str());
-                    double price = atof(cmd[3].c_str());
+                    uint64_t start = now_ns();
 
+                    gbce.set_universe(*next);
+                    universe.swap(next);
+                    universe->show();
 
-                    if(gbce.trade(cmd[2],(buy) ? BUY_STOCK : SELL_STOCK,qty,price))
-                        std::cout << "Done. " << trade_db.size() << " Trading operations in the database" << std::endl;
-                    else
-                        std::cout << "ERROR: Cannot " << cmd[0] << " shares of " << cmd[2] << " at " << cmd[1] << std::endl;
+                    std::cout << "Done. " << gbce.stock_count() << " stocks in the index, built in ";
+                    std::cout << std::setprecision(2) << std::fixed << (now_ns() - start) / 1e6 << " ms" << std::endl;
                 }
             }
+            else if(universe)
+                universe->show();
+            else
+                std::cout << gbce.stock_count() << " sample stocks, no reference data loaded" << std::endl;
+        }
+        else if(!cmd[0].compare("startup"))
+        {
+            startup.show();
+        }
+        else if(!cmd[0].compare("tape"))
+        {
+            lock.unlock();
+
+            if(cmd.size() > 2 && !cmd[1].compare("cadence"))
+            {
+                tape.set_cadence(std::max(1,atoi(cmd[2].c_str())));
+                std::cout << "Done. Writers merge into the tape every " << tape.get_cadence() << " trades" << std::endl;
+            }
             else
             {
-                std::cout << "ERROR: syntax is '" << cmd[0] << " <quantity> <symbol> <price>'" << std::endl;
+                tape_local.flush();
+                tape.request_merge();
+
+                if(!tape.show((cmd.size() > 1) ? cmd[1] : "all"))
+                    std::cout << "ERROR: " << cmd[1] << " has not traded" << std::endl;
             }
         }
-        else if(!cmd[0].compare("list"))
+        else if(!cmd[0].compare("session"))
         {
-            gbce.list_trade();
+            if(cmd.size() > 3 && !cmd[1].compare("hours"))
+            {
+                if(sessions.set_hours(session_calendar::parse_time(cmd[2]),session_calendar::parse_time(cmd[3])))
+                    sessions.show();
+                else
+                    std::cout << "ERROR: Bad trading hours " << cmd[2] << " to " << cmd[3] << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("off"))
+            {
+                sessions.disable();
+                std::cout << "Done. The market never closes" << std::endl;
+            }
+            else if(cmd.size() > 3 && !cmd[1].compare("holiday") && !cmd[2].compare("drop"))
+            {
+                if(sessions.drop_holiday(session_calendar::parse_day(cmd[3])))
+                    std::cout << "Done. " << cmd[3] << " is a trading day" << std::endl;
+                else
+                    std::cout << "ERROR: " << cmd[3] << " is not a holiday" << std::endl;
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("holiday"))
+            {
+                int day = session_calendar::parse_day(cmd[2]);
+
+                if(day)
+                {
+                    sessions.add_holiday(day);
+                    std::cout << "Done. No trading on " << cmd[2] << std::endl;
+                }
+                else
+                    std::cout << "ERROR: Bad date " << cmd[2] << ", use YYYY-MM-DD" << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("close"))
+            {
+                archive.close(session_calendar::day_of(engine_time.now()));
+                archive.show_bars();
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("bars"))
+            {
+                archive.show_bars();
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("archive"))
+            {
+                archive.set_dir(cmd[2]);
+                std::cout << "Done. Sessions are archived to " << cmd[2] << std::endl;
+            }
+            else
+            {
+                sessions.show();
+                archive.show();
+            }
         }
-        else if(!cmd[0].compare("price"))
+        else if(!cmd[0].compare("threads"))
+        {
+            if(cmd.size() > 2)
+            {
+                int role = thread_topology::role(cmd[1]);
+
+                if(role < 0)
+                    std::cout << "ERROR: Unknown thread role " << cmd[1] << std::endl;
+                else if(!topology.set(role,cmd[2]))
+                    std::cout << "ERROR: Bad CPU list " << cmd[2] << " (0 to " << thread_topology::cpu_count() - 1 << ")" << std::endl;
+                else
+                    std::cout << "Done. " << cmd[1] << " threads run on " << cmd[2] << std::endl;
+            }
+            else
+            {
+                topology.show();
+            }
+        }
+        else if(!cmd[0].compare("hugepages"))
         {
-            gbce.price();
+            if(cmd.size() > 1)
+            {
+                int k = 0;
+
+                while(k < PAGES_KINDS && cmd[1].compare(page_names[k]))
+                    k++;
+
+                if(k == PAGES_KINDS)
+                {
+                    std::cout << "ERROR: syntax is 'hugepages off|thp|2mb|1gb'" << std::endl;
+                }
+                else
+                {
+                    huge_pages.set_mode(k);
+                    std::cout << "Done. Tables grow on " << page_names[k] << " pages" << std::endl;
+                }
+            }
+            else
+            {
+                huge_pages.show();
+            }
         }
-        else if(!cmd[0].compare("yield"))
+        else if(!cmd[0].compare("reserve"))
         {
-            gbce.dividend_yield();
+            // 'lock' may follow the trades or the window
+
+            bool pin = cmd.size() > 2 && !cmd.back().compare("lock");
+            size_t words = cmd.size() - (pin ? 1 : 0);
+            char *end[2] = { NULL, NULL };
+            long trades = (words > 1) ? strtol(cmd[1].c_str(),&end[0],10) : 0;
+            long window = (words > 2) ? strtol(cmd[2].c_str(),&end[1],10) : 0;
+
+            if(words > 1 && words < 4 && trades > 0 && !*end[0] && (words < 3 || (window >= 0 && end[1] != cmd[2].c_str() && !*end[1])))
+            {
+                uint64_t start = now_ns();
+                long faults = page_faults();
+
+                if(words < 3)
+                    window = trades / gbce.stock_count();
+
+                huge_pages.set_prefault(pin);
+
+                gbce.reserve(trades,window);
+#ifdef __linux__
+                feed.reserve();
+#endif
+                std::cout << "Done. Room for " << trades << " trades, " << window << " per stock window, in ";
+                std::cout << (now_ns() - start) / 1000000 << " ms (" << page_faults() - faults << " page faults)" << std::endl;
+
+                if(huge_pages.lock_failed())
+                    std::cout << "WARNING: Could not lock all tables in memory (see ulimit -l)" << std::endl;
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'reserve <trades> [window-trades] [lock]'" << std::endl;
+            }
         }
-        else if(!cmd[0].compare("pe"))
+        else if(!cmd[0].compare("bench"))
         {
-            gbce.pe_ratio();
+            if(cmd.size() > 1 && !cmd[1].compare("tlb"))
+            {
+                lock.unlock();
+                bench_tlb((cmd.size() > 2) ? std::max(1L,atol(cmd[2].c_str())) : 512);
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("metrics"))
+            {
+                lock.unlock();
+                bench_metrics((cmd.size() > 2) ? std::max(1L,atol(cmd[2].c_str())) : 50000);
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("screen"))
+            {
+                lock.unlock();
+                bench_screen((cmd.size() > 2) ? std::max(1L,atol(cmd[2].c_str())) : 50000);
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("tape"))
+            {
+                lock.unlock();
+                bench_tape((cmd.size() > 2) ? std::max(1,atoi(cmd[2].c_str())) : 4,
+                           (cmd.size() > 3) ? std::max(1L,atol(cmd[3].c_str())) : 1000);
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("parse"))
+            {
+                lock.unlock();
+                bench_parse((cmd.size() > 2) ? std::max(1L,atol(cmd[2].c_str())) : 64);
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("alerts"))
+            {
+                bench_alerts((cmd.size() > 2) ? atol(cmd[2].c_str()) : 100000);
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'bench tlb [MB]', 'bench metrics [stocks]', 'bench screen [stocks]', 'bench alerts [alerts]', 'bench tape [writers] [symbols]' or 'bench parse [MB]'" << std::endl;
+            }
+        }
+        else if(!cmd[0].compare("stats"))
+        {
+            std::cout << trade_db.size() << " trading operations in the database, room for ";
+            std::cout << trade_db.capacity() << " (" << gbce.get_reallocations() << " reallocations)" << std::endl;
+            std::cout << page_faults() << " page faults" << std::endl;
+
+            huge_pages.show();
+
+            topology.show();
+        }
+        else if(!cmd[0].compare("feed"))
+        {
+#ifdef __linux__
+            if(cmd.size() > 2 && !cmd[1].compare("start"))
+            {
+                lock.unlock();
+
+                if(feed.start(atoi(cmd[2].c_str()),(cmd.size() > 3) ? cmd[3].c_str() : NULL))
+                    std::cout << "Listening for trades on port " << cmd[2] << std::endl;
+                else
+                    std::cout << "ERROR: Cannot listen on port " << cmd[2] << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("stop"))
+            {
+                lock.unlock();
+                feed.stop();
+
+                std::cout << "Done. Feed stopped" << std::endl;
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("wait"))
+            {
+                int w = 0;
+
+                while(w <= WAIT_ADAPTIVE && cmd[2].compare(wait_names[w]))
+                    w++;
+
+                if(w > WAIT_ADAPTIVE)
+                {
+                    std::cout << "ERROR: Unknown wait strategy " << cmd[2] << std::endl;
+                }
+                else
+                {
+                    feed.set_strategy(w);
+                    std::cout << "Done. Ingestion waits by " << wait_names[w] << std::endl;
+                }
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("stats"))
+            {
+                feed.show_stats();
+            }
+            else if(cmd.size() > 3 && !cmd[1].compare("replay"))
+            {
+                std::vector<ticker> symbols = gbce.symbols();
+                int port = atoi(cmd[2].c_str());
+
+                lock.unlock();
+
+                int sent = feed_replay(symbols,port,atol(cmd[3].c_str()),
+                                       (cmd.size() > 4) ? atoi(cmd[4].c_str()) : 0,
+                                       (cmd.size() > 5) ? atoi(cmd[5].c_str()) : 0,
+                                       (cmd.size() > 6) ? atoi(cmd[6].c_str()) : 0,
+                                       (cmd.size() > 7) ? cmd[7].c_str() : NULL);
+
+                if(sent < 0)
+                {
+                    std::cout << "ERROR: Cannot send to port " << cmd[2] << std::endl;
+                }
+                else
+                {
+                    if(feed.active() && feed.get_port() == port)
+                        feed.settle();
+
+                    std::cout << "Done. " << sent << " packets sent" << std::endl;
+                }
+            }
+            else
+            {
+                std::cout << "ERROR: syntax is 'feed start <port> [group]', 'feed stop', 'feed stats',";
+                std::cout << " 'feed wait spin|yield|block|adaptive'";
+                std::cout << " or 'feed replay <port> <trades> [per-packet] [drop-every] [rate] [group]'" << std::endl;
+            }
+#else
+            std::cout << "ERROR: The feed handler is only available on Linux" << std::endl;
+#endif
+        }
+        else if(!cmd[0].compare("journal"))
+        {
+            if(cmd.size() > 2 && !cmd[1].compare("start"))
+            {
+                if(journal.start(cmd[2]))
+                    std::cout << "Done. Journaling commands to " << cmd[2] << std::endl;
+                else
+                    std::cout << "ERROR: Cannot journal to " << cmd[2] << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("stop"))
+            {
+                journal.stop();
+                journal.show();
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("dump"))
+            {
+                if(!dump_journal(cmd[2],(cmd.size() > 3) ? atol(cmd[3].c_str()) : ~(size_t)0))
+                    std::cout << "ERROR: " << cmd[2] << " is not a journal" << std::endl;
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("profile"))
+            {
+                if(!profile_journal(cmd[2]))
+                    std::cout << "ERROR: " << cmd[2] << " is not a journal" << std::endl;
+            }
+            else if(cmd.size() > 2 && !cmd[1].compare("replay"))
+            {
+                lock.unlock();
+
+                if(!replay_journal(cmd[2],(cmd.size() > 3) ? atol(cmd[3].c_str()) : 10))
+                    std::cout << "ERROR: " << cmd[2] << " is not a journal" << std::endl;
+            }
+            else
+            {
+                journal.show();
+            }
+        }
+        else if(!cmd[0].compare("metrics"))
+        {
+#ifdef __linux__
+            if(cmd.size() > 2 && !cmd[1].compare("start"))
+            {
+                if(metrics_http.start(atoi(cmd[2].c_str())))
+                    metrics_http.show();
+                else
+                    std::cout << "ERROR: Cannot serve metrics on port " << cmd[2] << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("stop"))
+            {
+                lock.unlock();
+                metrics_http.stop();
+                std::cout << "Done. Metrics not served" << std::endl;
+            }
+            else if(cmd.size() > 1 && !cmd[1].compare("dump"))
+            {
+                render_metrics(std::cout);
+            }
+            else
+            {
+                metrics_http.show();
+            }
+#else
+            std::cout << "ERROR: The metrics endpoint is only available on Linux" << std::endl;
+#endif
         }
         else
         {
@@ -474,6 +9111,8 @@ bool process_command(std::string cmdline)
         }
     }
 
+    tape_local.flush();
+
     return true;
 }
 
@@ -482,14 +9121,39 @@ bool process_command(std::string cmdline)
 int main(int argc,char **argv)
 {
     std::string cmd;
+    bool running = true;
+
+    startup.mark("main");
+    console.attach(std::cout);
 
     std::cout << std::endl << "Super Simple Stocks" << std::endl << std::endl;
     std::cout << "Use 'help' for instructions" << std::endl << std::endl;
 
-    do {
-        std::cout << "->";
-        getline(std::cin,cmd);
-    } while(process_command(cmd));
+    topology.join(ROLE_COMMAND,"command line");
+    startup.mark("banner");
+
+    // Arguments are commands to run before the prompt (eg. thread layout)
+
+    for(int i = 1; running && i < argc; i++)
+    {
+        std::cout << "->" << argv[i] << std::endl;
+
+        running = process_command(argv[i]);
+    }
+
+    if(running)
+    {
+        startup.mark("ready");
+
+        do {
+            std::cout << "->";
+            if(!getline(std::cin,cmd))
+                break;
+        } while(process_command(cmd));
+    }
+
+    journal.stop();
+    console.detach(std::cout);
 
     return 0;
 }
\ No newline at end of file